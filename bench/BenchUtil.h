@@ -0,0 +1,81 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "Timestamp.h"
+
+// 库的日志直接写std::cout，每个连接都会打印几行，测量时关掉；结果用printf输出
+inline void quietLogging() {
+    std::cout.setstate(std::ios::failbit);
+}
+
+// 从start到现在经过的秒数
+inline double elapsedSeconds(Timestamp start) {
+    return timeDifference(Timestamp::now(), start);
+}
+
+// 阻塞地连接本机port，服务器可能还没开始监听，失败时重试
+inline int benchConnect(uint16_t port, bool nonblock = false) {
+    sockaddr_in addr;
+    ::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 200; ++i) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            ::perror("socket");
+            ::exit(1);
+        }
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) ==
+            0) {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            if (nonblock) {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            }
+            return fd;
+        }
+        ::close(fd);
+        ::usleep(10 * 1000);
+    }
+    ::perror("connect");
+    ::exit(1);
+}
+
+// 排序后取分位数，q在[0, 1]之间
+inline double percentile(std::vector<double>& samples, double q) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t idx = static_cast<size_t>(q * (samples.size() - 1) + 0.5);
+    return samples[idx];
+}
+
+// 当前进程的常驻内存字节数
+inline size_t rssBytes() {
+    FILE* f = ::fopen("/proc/self/statm", "r");
+    if (f == nullptr) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0;
+    if (::fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    ::fclose(f);
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "ByteSearch.h"
+#include "Timestamp.h"
+
+// 在没有匹配的64KB数据上反复扫描，比较各个实现的吞吐量
+static const size_t kDataSize = 64 * 1024;
+static const int    kRounds = 20000;
+
+// 防止编译器把没有用到结果的查找优化掉
+static const char* volatile g_sink;
+
+static double benchCRLF(const std::string& data) {
+    const char* begin = data.data();
+    const char* end = begin + data.size();
+    Timestamp   start(Timestamp::now());
+    for (int i = 0; i < kRounds; ++i) {
+        g_sink = ByteSearch::findCRLF(begin, end);
+    }
+    return timeDifference(Timestamp::now(), start);
+}
+
+static double benchAnyOf(const std::string& data, const char* set) {
+    const char* begin = data.data();
+    const char* end = begin + data.size();
+    const size_t n = ::strlen(set);
+    Timestamp    start(Timestamp::now());
+    for (int i = 0; i < kRounds; ++i) {
+        g_sink = ByteSearch::findAnyOf(begin, end, set, n);
+    }
+    return timeDifference(Timestamp::now(), start);
+}
+
+int main() {
+    // 像HTTP头一样的文本，有'\r'和'\n'但是没有连在一起的CRLF
+    std::string data(kDataSize, 'a');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>('a' + i % 26);
+        if (i % 61 == 60) {
+            data[i] = '\r';
+        } else if (i % 67 == 66 && data[i - 1] != '\r') {
+            data[i] = '\n';
+        }
+    }
+    const double gigabytes = static_cast<double>(kDataSize) * kRounds / 1e9;
+    const char*  impls[] = {"scalar", "sse2", "avx2"};
+    ::printf("%-8s %14s %14s %14s\n", "impl", "CRLF GB/s", "anyOf(4) GB/s",
+             "anyOf(8) GB/s");
+    for (const char* name : impls) {
+        if (!ByteSearch::useImpl(name)) {
+            continue;
+        }
+        double crlf = benchCRLF(data);
+        double any4 = benchAnyOf(data, "{}[]");
+        double any8 = benchAnyOf(data, "{}[]<>;|");
+        ::printf("%-8s %14.2f %14.2f %14.2f\n", name, gigabytes / crlf,
+                 gigabytes / any4, gigabytes / any8);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+
+// 建立/关闭连接的速率：客户端线程反复连接、等服务器发来的1字节（说明连接
+// 已经在subloop中建立并登记）、关闭，统计每秒完成的连接数
+// 第四个参数比较接受连接的方式：single是baseLoop上一个Acceptor、轮询分给subloop，
+// perloop是kReusePortPerLoop，每个subloop各自监听、在本loop中建立连接
+// 用法：Churn_bench [subloop个数] [客户端线程数] [秒数] [single|perloop]
+static const uint16_t kPort = 19403;
+
+// 一个客户端线程，返回完成的连接数
+static uint64_t churn(double seconds) {
+    uint64_t  done = 0;
+    Timestamp start(Timestamp::now());
+    while (elapsedSeconds(start) < seconds) {
+        int  fd = benchConnect(kPort);
+        char c;
+        if (::read(fd, &c, 1) == 1) {
+            ++done;
+        }
+        // 直接RST关闭，客户端不留TIME_WAIT，不会耗尽本地端口
+        linger lin = {1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof lin);
+        ::close(fd);
+    }
+    return done;
+}
+
+int main(int argc, char* argv[]) {
+    const int    loops = argc > 1 ? ::atoi(argv[1]) : 4;
+    const int    clients = argc > 2 ? ::atoi(argv[2]) : 4;
+    const double seconds = argc > 3 ? ::atof(argv[3]) : 3.0;
+    const bool   perLoop = argc > 4 && ::strcmp(argv[4], "perloop") == 0;
+
+    quietLogging();
+    ::signal(SIGPIPE, SIG_IGN);
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "Churn",
+                     perLoop ? TcpServer::kReusePortPerLoop
+                             : TcpServer::kNoReusePort);
+    server.setThreadNum(loops);
+    server.setConnectionCallback([](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(std::string("x"));
+        }
+    });
+    server.start();
+
+    std::atomic<uint64_t> total(0);
+    double                elapsed = 0;
+    std::thread           driver([&] {
+        Timestamp                start(Timestamp::now());
+        std::vector<std::thread> threads;
+        for (int i = 0; i < clients; ++i) {
+            threads.emplace_back([&] { total += churn(seconds); });
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        elapsed = elapsedSeconds(start);
+        loop.quit();
+    });
+    loop.loop();
+    driver.join();
+    ::printf("%s loops=%d clients=%d: %lu connections in %.2fs, "
+             "%.0f conn/s\n",
+             perLoop ? "perloop" : "single", loops, clients,
+             static_cast<unsigned long>(total.load()), elapsed,
+             total / elapsed);
+}
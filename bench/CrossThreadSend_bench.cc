@@ -0,0 +1,159 @@
+#include <poll.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "Buffer.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+
+// 4个subloop的服务器，8个连接，一个非loop线程轮流向各个连接send，
+// 另一个线程从客户端socket读走数据，统计跨线程发送的吞吐量
+// legacy模拟改动之前的做法：std::bind拷贝一份string，包成std::function交给runInLoop
+// 其余模式经过每个连接的暂存链表，batches是loop drain的次数，
+// send/batch是平均每次drain合并的发送数；链表没有容量上限，不存在加锁的溢出路径
+static const uint16_t kPort = 19401;
+static const int      kThreads = 4;
+static const int      kConnections = 8;
+
+enum Mode { kLegacy, kCopy, kMove, kBuffer };
+static const char* kModeNames[] = {"legacy", "copy", "move", "buffer"};
+
+static void sendCopied(const TcpConnectionPtr& conn, const std::string& msg) {
+    conn->send(msg);
+}
+
+static void sendOne(Mode mode, const TcpConnectionPtr& conn,
+                    const std::string& msg) {
+    switch (mode) {
+    case kLegacy: {
+        std::function<void()> f = std::bind(&sendCopied, conn, msg);
+        conn->getLoop()->runInLoop(std::move(f));
+        break;
+    }
+    case kCopy:
+        conn->send(msg);
+        break;
+    case kMove:
+        conn->send(std::string(msg));
+        break;
+    case kBuffer: {
+        Buffer buf;
+        buf.append(msg.data(), msg.size());
+        conn->send(std::move(buf));
+        break;
+    }
+    }
+}
+
+// 从所有客户端socket读满total字节
+static void drain(const std::vector<int>& fds, size_t total) {
+    std::vector<pollfd> pfds;
+    for (int fd : fds) {
+        pollfd pfd = {fd, POLLIN, 0};
+        pfds.push_back(pfd);
+    }
+    char   buf[256 * 1024];
+    size_t received = 0;
+    while (received < total) {
+        if (::poll(pfds.data(), pfds.size(), 5000) <= 0) {
+            ::fprintf(stderr, "drain timeout: %zu/%zu\n", received, total);
+            ::exit(1);
+        }
+        for (pollfd& pfd : pfds) {
+            if (pfd.revents & POLLIN) {
+                ssize_t n = ::read(pfd.fd, buf, sizeof buf);
+                if (n > 0) {
+                    received += n;
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    quietLogging();
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "CrossThreadSend");
+    server.setThreadNum(kThreads);
+
+    std::mutex                    mutex;
+    std::condition_variable       cond;
+    std::vector<TcpConnectionPtr> conns;
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            conns.push_back(conn);
+            cond.notify_all();
+        }
+    });
+    server.start();
+
+    std::thread driver([&] {
+        std::vector<int> fds;
+        for (int i = 0; i < kConnections; ++i) {
+            fds.push_back(benchConnect(kPort));
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return conns.size() == kConnections; });
+        }
+
+        const size_t sizes[] = {64, 4096};
+        const int    counts[] = {400000, 40000};
+        // 所有连接暂存的发送数和drain次数
+        auto stagedTotals = [&conns](uint64_t* sends, uint64_t* batches) {
+            *sends = 0;
+            *batches = 0;
+            for (const TcpConnectionPtr& conn : conns) {
+                *sends += conn->stagedSendCount();
+                *batches += conn->stagedBatchCount();
+            }
+        };
+        ::printf("%-8s %8s %12s %12s %10s %10s\n", "mode", "msg", "MB/s",
+                 "Kmsg/s", "batches", "send/batch");
+        for (int s = 0; s < 2; ++s) {
+            std::string msg(sizes[s], 'x');
+            size_t      total = sizes[s] * counts[s];
+            for (int m = kLegacy; m <= kBuffer; ++m) {
+                uint64_t sendsBefore = 0;
+                uint64_t batchesBefore = 0;
+                stagedTotals(&sendsBefore, &batchesBefore);
+                Timestamp   start(Timestamp::now());
+                std::thread sink(drain, std::cref(fds), total);
+                for (int i = 0; i < counts[s]; ++i) {
+                    sendOne(static_cast<Mode>(m), conns[i % kConnections],
+                            msg);
+                }
+                sink.join();
+                double   seconds = elapsedSeconds(start);
+                uint64_t sends = 0;
+                uint64_t batches = 0;
+                stagedTotals(&sends, &batches);
+                sends -= sendsBefore;
+                batches -= batchesBefore;
+                ::printf("%-8s %8zu %12.1f %12.1f %10lu %10.1f\n",
+                         kModeNames[m], sizes[s], total / seconds / 1e6,
+                         counts[s] / seconds / 1e3,
+                         static_cast<unsigned long>(batches),
+                         batches > 0 ? static_cast<double>(sends) / batches
+                                     : 0.0);
+            }
+        }
+
+        for (int fd : fds) {
+            ::close(fd);
+        }
+        loop.quit();
+    });
+    loop.loop();
+    driver.join();
+}
@@ -0,0 +1,137 @@
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "Buffer.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "SharedPayload.h"
+#include "TcpServer.h"
+
+// 水平触发和边沿触发的服务器吞吐量
+// echo：每个连接保持msgSize字节在途，客户端收到多少就回写多少（pingpong）
+// chargen：服务器每发完一块就再发一块，客户端只读
+// 用法：Echo_bench [echo|chargen|all] [lt|et|all] [连接数] [秒数] [消息字节数]
+// 设置MUDUO_USE_IOURING时服务器使用io_uring的poll后端
+static const uint16_t kPort = 19402;
+
+struct Options {
+    int    conns;
+    double seconds;
+    size_t msgSize;
+};
+
+// 客户端线程：所有连接放在一个poll里，返回每秒收到的字节数
+static uint64_t runClient(bool echo, const Options& opt) {
+    std::vector<int>    fds;
+    std::vector<pollfd> pfds;
+    std::string         message(opt.msgSize, 'e');
+    for (int i = 0; i < opt.conns; ++i) {
+        int fd = benchConnect(kPort, true);
+        fds.push_back(fd);
+        pollfd pfd = {fd, POLLIN, 0};
+        pfds.push_back(pfd);
+        if (echo) {
+            ::write(fd, message.data(), message.size());
+        }
+    }
+
+    std::vector<char> buf(256 * 1024);
+    uint64_t          received = 0;
+    Timestamp         start(Timestamp::now());
+    while (elapsedSeconds(start) < opt.seconds) {
+        if (::poll(pfds.data(), pfds.size(), 100) <= 0) {
+            continue;
+        }
+        for (pollfd& pfd : pfds) {
+            if (!(pfd.revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = ::read(pfd.fd, buf.data(), buf.size());
+            if (n <= 0) {
+                continue;
+            }
+            received += n;
+            if (echo) {
+                // 在途的数据不超过msgSize，发送缓冲区不会写满
+                ::write(pfd.fd, buf.data(), n);
+            }
+        }
+    }
+    double seconds = elapsedSeconds(start);
+    for (int fd : fds) {
+        ::close(fd);
+    }
+    return static_cast<uint64_t>(received / seconds);
+}
+
+static void runOnce(bool echo, bool edgeTriggered, const Options& opt) {
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "Echo");
+    server.setEdgeTriggered(edgeTriggered);
+    SharedPayloadPtr chunk =
+        SharedPayload::create(std::string(opt.msgSize, 'c'));
+    if (echo) {
+        server.setMessageCallback(
+            [](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+                conn->send(buf);
+            });
+    } else {
+        server.setConnectionCallback([chunk](const TcpConnectionPtr& conn) {
+            if (conn->connected()) {
+                conn->send(chunk);
+            }
+        });
+        server.setWriteCompleteCallback(
+            [chunk](const TcpConnectionPtr& conn) { conn->send(chunk); });
+    }
+    server.start();
+
+    uint64_t    bytesPerSecond = 0;
+    std::thread client([&] {
+        bytesPerSecond = runClient(echo, opt);
+        loop.quit();
+    });
+    loop.loop();
+    client.join();
+    ::printf("%-8s %-4s %6d %8zu %12.1f\n", echo ? "echo" : "chargen",
+             edgeTriggered ? "et" : "lt", opt.conns, opt.msgSize,
+             bytesPerSecond / 1e6);
+}
+
+int main(int argc, char* argv[]) {
+    const char* test = argc > 1 ? argv[1] : "all";
+    const char* trigger = argc > 2 ? argv[2] : "all";
+    Options     opt;
+    opt.conns = argc > 3 ? ::atoi(argv[3]) : 16;
+    opt.seconds = argc > 4 ? ::atof(argv[4]) : 2.0;
+    opt.msgSize = argc > 5 ? ::atol(argv[5]) : 16 * 1024;
+
+    quietLogging();
+    // 客户端关闭时服务器可能还在写
+    ::signal(SIGPIPE, SIG_IGN);
+    ::printf("poller: %s\n",
+             ::getenv("MUDUO_USE_IOURING") ? "io_uring" : "epoll");
+    ::printf("%-8s %-4s %6s %8s %12s\n", "test", "mode", "conns", "msg",
+             "MB/s");
+    for (int e = 1; e >= 0; --e) {
+        if (::strcmp(test, "all") != 0 &&
+            ::strcmp(test, e ? "echo" : "chargen") != 0) {
+            continue;
+        }
+        for (int et = 0; et <= 1; ++et) {
+            if (::strcmp(trigger, "all") != 0 &&
+                ::strcmp(trigger, et ? "et" : "lt") != 0) {
+                continue;
+            }
+            runOnce(e != 0, et != 0, opt);
+        }
+    }
+}
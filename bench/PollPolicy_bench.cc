@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpServer.h"
+
+// 每种等待策略下的pingpong延迟：服务器loop单独一个线程，客户端阻塞地
+// 发1字节、等回显，统计往返时间的p50/p99/p999
+// 用法：PollPolicy_bench [往返次数] [spin微秒]
+static const uint16_t kPort = 19404;
+static const int      kWarmup = 1000;
+
+static const char* policyName(EventLoop::PollPolicy policy) {
+    switch (policy) {
+    case EventLoop::kBlocking:
+        return "blocking";
+    case EventLoop::kBusyPoll:
+        return "busypoll";
+    case EventLoop::kSpinThenBlock:
+        return "spin";
+    case EventLoop::kAdaptive:
+        return "adaptive";
+    }
+    return "?";
+}
+
+static void runPolicy(EventLoop::PollPolicy policy, double spinSeconds,
+                      int rounds) {
+    std::atomic<EventLoop*> serverLoop(nullptr);
+    std::thread             server([&] {
+        EventLoop loop;
+        TcpServer server(&loop, InetAddress(kPort), "PollPolicy");
+        server.setMessageCallback(
+            [](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+                conn->send(buf);
+            });
+        server.start();
+        loop.setPollPolicy(policy, spinSeconds);
+        serverLoop = &loop;
+        loop.loop();
+    });
+    while (serverLoop.load() == nullptr) {
+        std::this_thread::yield();
+    }
+
+    int                 fd = benchConnect(kPort);
+    std::vector<double> samples;
+    samples.reserve(rounds);
+    char c = 'p';
+    for (int i = 0; i < kWarmup + rounds; ++i) {
+        Timestamp start(Timestamp::now());
+        if (::write(fd, &c, 1) != 1 || ::read(fd, &c, 1) != 1) {
+            ::perror("pingpong");
+            ::exit(1);
+        }
+        if (i >= kWarmup) {
+            samples.push_back(elapsedSeconds(start) * 1e6);
+        }
+    }
+    ::close(fd);
+    serverLoop.load()->quit();
+    server.join();
+
+    ::printf("%-10s %10.1f %10.1f %10.1f\n", policyName(policy),
+             percentile(samples, 0.5), percentile(samples, 0.99),
+             percentile(samples, 0.999));
+}
+
+int main(int argc, char* argv[]) {
+    const int    rounds = argc > 1 ? ::atoi(argv[1]) : 20000;
+    const double spinSeconds =
+        argc > 2 ? ::atof(argv[2]) * 1e-6 : EventLoop::kDefaultSpinSeconds;
+
+    quietLogging();
+    ::printf("%d round trips, spin %.0fus, %u CPUs\n", rounds,
+             spinSeconds * 1e6, std::thread::hardware_concurrency());
+    ::printf("%-10s %10s %10s %10s\n", "policy", "p50 us", "p99 us",
+             "p999 us");
+    const EventLoop::PollPolicy policies[] = {
+        EventLoop::kBlocking, EventLoop::kBusyPoll, EventLoop::kSpinThenBlock,
+        EventLoop::kAdaptive};
+    for (EventLoop::PollPolicy policy : policies) {
+        runPolicy(policy, spinSeconds, rounds);
+    }
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "EventLoop.h"
+
+// 1到32个生产者线程同时queueInLoop，loop线程执行回调，统计每秒执行的回调数
+// 用法：QueueInLoop_bench [每轮回调总数]
+int main(int argc, char* argv[]) {
+    const uint64_t total = argc > 1 ? ::atol(argv[1]) : 2000000;
+
+    quietLogging();
+    EventLoop             loop;
+    std::atomic<uint64_t> executed(0);
+
+    std::thread driver([&] {
+        ::printf("%10s %12s %14s\n", "producers", "ms", "Mtasks/s");
+        for (int producers = 1; producers <= 32; producers *= 2) {
+            executed.store(0);
+            const uint64_t perProducer = total / producers;
+            const uint64_t expected = perProducer * producers;
+            Timestamp      start(Timestamp::now());
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; ++p) {
+                threads.emplace_back([&loop, &executed, perProducer] {
+                    for (uint64_t i = 0; i < perProducer; ++i) {
+                        // 只在loop线程中修改，用relaxed读写即可
+                        loop.queueInLoop([&executed] {
+                            executed.store(
+                                executed.load(std::memory_order_relaxed) + 1,
+                                std::memory_order_relaxed);
+                        });
+                    }
+                });
+            }
+            for (std::thread& t : threads) {
+                t.join();
+            }
+            while (executed.load(std::memory_order_relaxed) < expected) {
+                std::this_thread::yield();
+            }
+            double seconds = elapsedSeconds(start);
+            ::printf("%10d %12.1f %14.2f\n", producers, seconds * 1e3,
+                     expected / seconds / 1e6);
+        }
+        loop.quit();
+    });
+    loop.loop();
+    driver.join();
+}
@@ -9,6 +9,10 @@ public:
                   bool print = false);
 
     void start();
+    void setEdgeTriggered(bool on)
+    {
+        server_.setEdgeTriggered(on);
+    }
 
 private:
     void onConnection(const TcpConnectionPtr &conn);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <arpa/inet.h>
+
 #include "Buffer.h"
 #include "Logger.h"
 #include "TcpConnection.h"
@@ -17,8 +19,8 @@ public:
                    Timestamp receiveTime) {
         while (buf->readableBytes() >= kHeaderLen)  // kHeaderLen == 4
         {
-            const void* data = buf->peek();
-            int32_t     len = *static_cast<const int32_t*>(data);  // SIGBUS
+            // 网络字节序，按字节拷贝读取，不要求对齐
+            const int32_t len = buf->peekInt32();
 
             if (len > 65536 || len < 0) {
                 LOG_ERROR("Invalid length %d", len);
@@ -35,12 +37,24 @@ public:
         }
     }
 
+    // 包头和消息体作为两段一次writev发出，不再拼接临时Buffer
     void send(TcpConnection* conn, const std::string& message) {
-        Buffer buf;
-        buf.append(message.data(), message.size());
-        int32_t len = static_cast<int32_t>(message.size());
-        buf.prepend(&len, sizeof len);
-        conn->send(&buf);
+        int32_t be32 = htonl(static_cast<int32_t>(message.size()));
+        conn->send({{&be32, sizeof be32}, {message.data(), message.size()}});
+    }
+
+    // 广播时只编码一次，得到的payload可以发给任意多个连接
+    SharedPayloadPtr encode(const std::string& message) const {
+        int32_t     be32 = htonl(static_cast<int32_t>(message.size()));
+        std::string frame;
+        frame.reserve(kHeaderLen + message.size());
+        frame.append(reinterpret_cast<const char*>(&be32), sizeof be32);
+        frame.append(message);
+        return SharedPayload::create(std::move(frame));
+    }
+
+    void send(TcpConnection* conn, const SharedPayloadPtr& payload) {
+        conn->send(payload);
     }
 
 private:
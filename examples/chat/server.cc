@@ -34,11 +34,13 @@ private:
         }
     }
 
+    // 消息只编码一次，所有连接共享同一份payload，各自只持有引用
     void onStringMessage(const TcpConnectionPtr&,
                          const std::string& message, Timestamp) {
+        SharedPayloadPtr payload = codec_.encode(message);
         for (auto it = connections_.begin(); it != connections_.end();
              ++it) {
-            codec_.send(it->get(), message);
+            codec_.send(it->get(), payload);
         }
     }
 
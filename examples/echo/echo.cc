@@ -31,5 +31,5 @@ void EchoServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf,
     std::string msg(buf->retrieveAllAsString());
     LOG_INFO("%s recevie %d bytes recevied at %s", conn->name().c_str(),
              msg.size(), time.toString().c_str());
-    conn->send(msg);
+    conn->send(std::move(msg));
 }
@@ -8,6 +8,10 @@ public:
     EchoServer(EventLoop *loop, InetAddress &listenAddr);
 
     void start();
+    void setEdgeTriggered(bool on)
+    {
+        server_.setEdgeTriggered(on);
+    }
 
 private:
     void onConnection(const TcpConnectionPtr &conn);
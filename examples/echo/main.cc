@@ -1,13 +1,19 @@
 #include "echo.h"
 #include <mymuduo/Logger.h>
+#include <string.h>
 #include <unistd.h>
 
-int main()
+// 带参数et时使用边沿触发，便于和默认的水平触发对比
+int main(int argc, char *argv[])
 {
     LOG_INFO("pid = %d", getpid());
     EventLoop loop;
     InetAddress listenAddr(2024);
     EchoServer server(&loop, listenAddr);
+    if (argc > 1 && strcmp(argv[1], "et") == 0)
+    {
+        server.setEdgeTriggered(true);
+    }
     server.start();
     loop.loop();
 }
@@ -2,34 +2,13 @@
 #include <mymuduo/EventLoop.h>
 #include <mymuduo/TcpServer.h>
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 const char *g_file = NULL;
 
-// FIXME: use FileUtil::readFile()
-std::string readFile(const char *filename)
-{
-  std::string content;
-  FILE *fp = ::fopen(filename, "rb");
-  if (fp)
-  {
-    // inefficient!!!
-    const int kBufSize = 1024 * 1024; // 1M
-    char iobuf[kBufSize];
-    ::setbuffer(fp, iobuf, sizeof iobuf);
-
-    char buf[kBufSize];
-    size_t nread = 0;
-    while ((nread = ::fread(buf, 1, sizeof buf, fp)) > 0)
-    {
-      content.append(buf, nread);
-    }
-    ::fclose(fp);
-  }
-  return content;
-}
-
 void onHighWaterMark(const TcpConnectionPtr &conn, size_t len)
 {
   LOG_INFO("HighWaterMark %d", len);
@@ -54,8 +33,24 @@ void onConnection(const TcpConnectionPtr &conn)
     LOG_INFO("FileServer - Sending file %s to %s", g_file,
              conn->peerAddress().toIpPort().c_str());
     conn->setHighWaterMarkCallback(onHighWaterMark, 64 * 1024);
-    std::string fileContent = readFile(g_file);
-    conn->send(fileContent);
+
+    // 文件内容由内核通过sendfile直接发往socket，不经过用户态内存
+    int fd = ::open(g_file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && ::fstat(fd, &st) == 0)
+    {
+      conn->sendFile(fd, 0, static_cast<size_t>(st.st_size));
+    }
+    else
+    {
+      LOG_ERROR("FileServer - open %s failed", g_file);
+    }
+    if (fd >= 0)
+    {
+      // sendFile内部持有dup出来的fd，这里可以直接关闭
+      ::close(fd);
+    }
+    // 文件发送完之后才会真正关闭写端
     conn->shutdown();
     LOG_INFO("FileServer - done");
   }
@@ -81,4 +76,4 @@ int main(int argc, char *argv[])
   }
 }
 
-// g++ -o FileServer1 download.cc -pthread -lmymuduo -std=c++11 -g
\ No newline at end of file
+// g++ -o FileServer1 download.cc -pthread -lmymuduo -std=c++11 -g
@@ -27,6 +27,8 @@ public:
     void listen();
 
 private:
+    static const int kMaxAcceptsPerEvent = 16;
+
     void handleRead();
 
     EventLoop*            loop_;
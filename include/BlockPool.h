@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "noncopyable.h"
+
+// 按大小分级缓存内存块的池子，每个EventLoop拥有一个，
+// 该loop上所有连接的Buffer存储都从这里申请
+//  size class: | 1K | 2K | 4K | 8K | 16K | 32K | 64K |
+// 空闲块用块内存本身串成单链表，申请和归还都是O(1)且不加锁；
+// 超过最大级别的申请直接走malloc。
+// 只能在所属loop线程中申请，其他线程归还的块先挂到remoteFree_上，
+// 由loop线程在下一次申请时统一回收
+class BlockPool : noncopyable {
+public:
+    static const size_t kMinBlockSize = 1024;  // 最小级别 1KB
+    static const int    kNumSizeClasses = 7;   // 1KB ~ 64KB
+    static const size_t kMaxBlockSize = kMinBlockSize
+                                        << (kNumSizeClasses - 1);
+    // 大页arena每次向系统申请的内存大小 2MB
+    static const size_t kArenaChunkSize = 2 * 1024 * 1024;
+    // 不使用arena时每个级别最多缓存的空闲字节数，多余的直接还给malloc
+    static const size_t kMaxFreeBytesPerClass = 16 * 1024 * 1024;
+
+    struct Stats {
+        size_t blocksInUse;  // 已经借出的块数
+        size_t blocksFree;   // 池中缓存的空闲块数
+        size_t highWater;    // blocksInUse的历史最大值
+        size_t bytesInUse;   // 借出块的总字节数
+        size_t bytesFree;    // 空闲块的总字节数
+        size_t largeInUse;   // 超过kMaxBlockSize直接malloc的块数
+    };
+
+    // useHugePageArena为true时块从madvise(MADV_HUGEPAGE)的2MB区域中切分
+    explicit BlockPool(bool useHugePageArena = false);
+    ~BlockPool();
+
+    // 申请至少size字节的内存，*actual返回实际可用的大小（向上取整到级别大小）
+    char* allocate(size_t size, size_t* actual);
+    // 归还内存，size必须是allocate返回的*actual
+    void deallocate(char* data, size_t size);
+
+    Stats stats() const;
+
+    bool useHugePageArena() const {
+        return arenaEnabled_;
+    }
+
+private:
+    // 空闲链表节点，就存放在空闲块的开头
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct SizeClass {
+        FreeNode* freeList;
+        size_t    freeCount;
+    };
+
+    static int sizeClassOf(size_t size);
+    static size_t classSize(int index) {
+        return kMinBlockSize << index;
+    }
+
+    bool  inOwnerThread() const;
+    char* carve(size_t size);
+    void  pushFree(int index, char* data);
+    void  reclaimRemote();
+
+    const pid_t threadId_;
+    bool        arenaEnabled_;
+
+    SizeClass classes_[kNumSizeClasses];
+
+    // arena中正在切分的chunk
+    std::vector<char*> chunks_;
+    char*              arenaCur_;
+    char*              arenaEnd_;
+
+    // 统计信息，loop线程写，其他线程可读
+    std::atomic<size_t> blocksInUse_;
+    std::atomic<size_t> blocksFree_;
+    std::atomic<size_t> highWater_;
+    std::atomic<size_t> bytesInUse_;
+    std::atomic<size_t> bytesFree_;
+    std::atomic<size_t> largeInUse_;
+
+    // 其他线程归还的块
+    std::mutex                             mutex_;
+    std::vector<std::pair<char*, size_t>>  remoteFree_;
+    std::atomic_bool                       hasRemoteFree_;
+};
+
+using BlockPoolPtr = std::shared_ptr<BlockPool>;
@@ -1,44 +1,124 @@
 #pragma once
 
+#include <assert.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "BlockPool.h"
+#include "SharedPayload.h"
+
 // 网络库缓冲区类型定义
 //  |   prepend   |     readable    |  writeable  |
 //  ^             ^                 ^
 //  0        readerIndex_       writerIndex_
+//
+// 分段模式（kSegmented）下缓冲区由若干固定大小的块组成：
+//  | block0: prepend | readable | -> | block1: readable | -> ... -> | blockN: readable | writable |
+// 追加数据只会写入尾块或者新申请的块，已有数据永远不会被搬移；
+// retrieve只是释放已经读完的头部块；writeFd一次writev最多发送IOV_MAX个块
+// 块也可以直接引用一个SharedPayload（appendShared），字节不拷贝，块出队时释放引用
+// 零拷贝发送出去的块通过pin()转成引用计数的块，内核发送完成之前内存不会被复用
+// detach()把全部数据以引用的形式交出去，配合appendRef()在缓冲区之间转移数据而不拷贝
+
+// 分散发送的一段数据，例如包头、消息体和包尾
+struct Slice {
+    const void* data;
+    size_t      len;
+};
 
 class Buffer {
 public:
+    // 块内存的引用，持有它的期间内存不会被释放或复用
+    using BlockRef = std::shared_ptr<const void>;
+
     // 往前添加数据，序列化消息时可以使用
     static const size_t kCheapPretend = 8;
     static const size_t kInitialSize = 1024;  // 1KB
+    static const size_t kBlockSize = 16 * 1024;  // 分段模式下每个块16KB
+
+    enum Mode {
+        kContiguous,  // 一整块连续内存，空间不够时搬移或扩容
+        kSegmented,   // 块链表，适合积压大量待发送数据的outputBuffer_
+    };
+
+    // pool为空时使用全局分配器，否则存储从pool（通常是连接所属loop的池子）中申请
+    // initialSize为0时不预先申请存储，第一次写入数据时才申请
+    explicit Buffer(size_t initialSize = kInitialSize,
+                    const BlockPoolPtr& pool = BlockPoolPtr());
 
-    explicit Buffer(size_t initialSize = kInitialSize)
-        : buffer_(kCheapPretend + initialSize),
-          readerIndex_(kCheapPretend),
-          writerIndex_(kCheapPretend) {}
+    // 分段模式的缓冲区，blockSize为每次新申请块的大小
+    explicit Buffer(Mode mode, size_t blockSize = kBlockSize,
+                    const BlockPoolPtr& pool = BlockPoolPtr());
+
+    // 拷贝出来的缓冲区不再使用原来的池子
+    Buffer(const Buffer& rhs);
+    Buffer(Buffer&& rhs) noexcept;
+    Buffer& operator=(Buffer rhs);
+    ~Buffer();
+
+    void swap(Buffer& rhs) noexcept;
+
+    Mode mode() const {
+        return mode_;
+    }
+    bool segmented() const {
+        return mode_ == kSegmented;
+    }
 
     // 可读字节数
     size_t readableBytes() const {
-        return writerIndex_ - readerIndex_;
+        return segmented() ? readable_ : writerIndex_ - readerIndex_;
     }
-    // 剩余可写字节数
+    // 剩余可写字节数，分段模式下为尾块剩余空间
     size_t writableBytes() const {
-        return buffer_.size() - writerIndex_;
+        if (segmented()) {
+            return blocks_.empty()
+                       ? 0
+                       : blocks_.back().size - blocks_.back().writeIndex;
+        }
+        return capacity_ - writerIndex_;
     }
-    // 可向前添加的字节数
+    // 可向前添加的字节数，分段模式下为头块前部的空闲空间
     size_t pretendableBytes() const {
+        if (segmented()) {
+            // 引用的SharedPayload是只读的，不能往前写
+            return blocks_.empty() || blocks_.front().payload
+                       ? 0
+                       : blocks_.front().readIndex;
+        }
         return readerIndex_;
     }
     // 缓冲区中可读数据的起始地址
+    // 分段模式下会先把所有可读数据拷贝合并到一个块中，代价是O(n)的拷贝，
+    // 只应该在解析数据时使用；发送路径用writeFd/detach，按块组织iovec，不需要合并
     const char* peek() const {
+        if (segmented()) {
+            return linearize();
+        }
         return begin() + readerIndex_;
     }
 
+    // 在可读数据中查找分隔符，找到返回其地址（在peek()返回的内存中），否则返回nullptr
+    // hint为已经确认不含分隔符的可读字节数，例如上一次没找到时的readableBytes()，
+    // 从hint处继续扫描，收到半行数据时不用每次handleRead都从头扫描
+    const char* findCRLF(size_t hint = 0) const;
+    const char* findEOL(size_t hint = 0) const;
+    const char* findByte(char c, size_t hint = 0) const;
+    // 查找set[0, n)中任意一个字节
+    const char* findAnyOf(const char* set, size_t n, size_t hint = 0) const;
+
     // 回收len bits的内存
     void retrieve(size_t len) {
-        if (len < readableBytes()) {
+        if (segmented()) {
+            retrieveSegments(len);
+        } else if (len < readableBytes()) {
             // 说明应用只读取了可读缓冲区的一部分数据，长度为len，
             // 剩下readerIndex - len
             readerIndex_ += len;
@@ -48,23 +128,16 @@ public:
     }
 
     // 回收所有内存，变为可写
-    void retrieveAll() {
-        readerIndex_ = kCheapPretend;
-        writerIndex_ = kCheapPretend;
-    }
+    void retrieveAll();
 
     // 把 onMessage 函数上报的 Buffer 数据转成 string 类型的数据返回
     std::string retrieveAllAsString() {
         return retrieveAsString(readableBytes());
     }
-    std::string retrieveAsString(size_t len) {
-        std::string result(peek(), len);
-        // 已经读出缓冲区中数据，所以复位缓冲区
-        retrieve(len);
-        return result;
-    }
+    std::string retrieveAsString(size_t len);
 
     // 确认缓冲区是否足够可写
+    // 分段模式下保证尾块有len字节的连续空间
     void ensureWritableBytes(size_t len) {
         if (writableBytes() < len) {
             makeSpace(len);  // 不够就扩容呗
@@ -73,62 +146,262 @@ public:
 
     // 可写地址
     char* beginWrite() {
+        if (segmented()) {
+            return blocks_.empty() ? nullptr : blocks_.back().writePtr();
+        }
         return begin() + writerIndex_;
     }
     const char* beginWrite() const {
+        if (segmented()) {
+            return blocks_.empty() ? nullptr : blocks_.back().writePtr();
+        }
         return begin() + writerIndex_;
     }
 
     // 把[data, data+len]栈内存上的数据添加到 writable 缓冲区中
     void append(const char* data, size_t len) {
+        if (segmented()) {
+            appendSegments(data, len);
+            return;
+        }
         ensureWritableBytes(len);
         std::copy(data, data + len, beginWrite());
         writerIndex_ += len;
     }
 
+    // 追加payload中从offset开始的数据
+    // 分段模式下只在块链表中挂一个引用，连续模式下退化为拷贝
+    void appendShared(const SharedPayloadPtr& payload, size_t offset = 0);
+    // 追加[data, data+len)，这段内存由ref保证有效，同样只在分段模式下挂引用
+    void appendRef(const BlockRef& ref, const char* data, size_t len);
+
+    // 整数都按网络字节序（大端）读写，用memcpy访问，不要求地址对齐
+    void appendInt64(int64_t x) {
+        uint64_t be64 = htobe64(static_cast<uint64_t>(x));
+        append(reinterpret_cast<const char*>(&be64), sizeof be64);
+    }
+    void appendInt32(int32_t x) {
+        uint32_t be32 = htobe32(static_cast<uint32_t>(x));
+        append(reinterpret_cast<const char*>(&be32), sizeof be32);
+    }
+    void appendInt16(int16_t x) {
+        uint16_t be16 = htobe16(static_cast<uint16_t>(x));
+        append(reinterpret_cast<const char*>(&be16), sizeof be16);
+    }
+    void appendInt8(int8_t x) {
+        append(reinterpret_cast<const char*>(&x), sizeof x);
+    }
+
+    // 调用前需要保证readableBytes()足够
+    int64_t peekInt64() const {
+        assert(readableBytes() >= sizeof(int64_t));
+        uint64_t be64 = 0;
+        ::memcpy(&be64, peek(), sizeof be64);
+        return static_cast<int64_t>(be64toh(be64));
+    }
+    int32_t peekInt32() const {
+        assert(readableBytes() >= sizeof(int32_t));
+        uint32_t be32 = 0;
+        ::memcpy(&be32, peek(), sizeof be32);
+        return static_cast<int32_t>(be32toh(be32));
+    }
+    int16_t peekInt16() const {
+        assert(readableBytes() >= sizeof(int16_t));
+        uint16_t be16 = 0;
+        ::memcpy(&be16, peek(), sizeof be16);
+        return static_cast<int16_t>(be16toh(be16));
+    }
+    int8_t peekInt8() const {
+        assert(readableBytes() >= sizeof(int8_t));
+        return static_cast<int8_t>(*peek());
+    }
+
+    int64_t readInt64() {
+        int64_t result = peekInt64();
+        retrieve(sizeof result);
+        return result;
+    }
+    int32_t readInt32() {
+        int32_t result = peekInt32();
+        retrieve(sizeof result);
+        return result;
+    }
+    int16_t readInt16() {
+        int16_t result = peekInt16();
+        retrieve(sizeof result);
+        return result;
+    }
+    int8_t readInt8() {
+        int8_t result = peekInt8();
+        retrieve(sizeof result);
+        return result;
+    }
+
+    void prependInt64(int64_t x) {
+        uint64_t be64 = htobe64(static_cast<uint64_t>(x));
+        prepend(&be64, sizeof be64);
+    }
+    void prependInt32(int32_t x) {
+        uint32_t be32 = htobe32(static_cast<uint32_t>(x));
+        prepend(&be32, sizeof be32);
+    }
+    void prependInt16(int16_t x) {
+        uint16_t be16 = htobe16(static_cast<uint16_t>(x));
+        prepend(&be16, sizeof be16);
+    }
+    void prependInt8(int8_t x) {
+        prepend(&x, sizeof x);
+    }
+
+    // LEB128变长整数，每字节7位、低位在前，最高位为1表示后面还有字节
+    // 有符号数先做zigzag编码，绝对值小的负数也只占很少的字节
+    static const size_t kMaxVarintBytes = 10;
+
+    static uint64_t zigzagEncode(int64_t x) {
+        return (static_cast<uint64_t>(x) << 1) ^
+               static_cast<uint64_t>(x >> 63);
+    }
+    static int64_t zigzagDecode(uint64_t x) {
+        return static_cast<int64_t>(x >> 1) ^ -static_cast<int64_t>(x & 1);
+    }
+
+    void appendVarUint64(uint64_t x);
+    void appendVarInt64(int64_t x) {
+        appendVarUint64(zigzagEncode(x));
+    }
+    // 返回varint占用的字节数；数据还不完整返回0；
+    // 超过kMaxVarintBytes仍未结束或者数值超出uint64_t返回-1
+    int peekVarUint64(uint64_t* x) const;
+    int peekVarInt64(int64_t* x) const {
+        uint64_t u = 0;
+        int      n = peekVarUint64(&u);
+        if (n > 0) {
+            *x = zigzagDecode(u);
+        }
+        return n;
+    }
+    // 和peek*一样的返回值，成功时同时回收这些字节
+    int readVarUint64(uint64_t* x) {
+        int n = peekVarUint64(x);
+        if (n > 0) {
+            retrieve(n);
+        }
+        return n;
+    }
+    int readVarInt64(int64_t* x) {
+        int n = peekVarInt64(x);
+        if (n > 0) {
+            retrieve(n);
+        }
+        return n;
+    }
+
     // 向前增加缓冲区
     void prepend(const void* data, size_t len) {
+        if (segmented()) {
+            prependSegment(data, len);
+            return;
+        }
+        if (buffer_ == nullptr) {
+            makeSpace(0);  // 还没有申请存储
+        }
+        // 连续模式只能用前面预留的空间，最多kCheapPretend字节
+        assert(len <= pretendableBytes());
         readerIndex_ -= len;
         const char* d = static_cast<const char*>(data);
         // 相当于从 readerIndex 开始向前拷贝了 len 个空数据
         std::copy(d, d + len, begin() + readerIndex_);
     }
 
+    // 可读数据中属于这个缓冲区的字节数，不含appendShared引用的SharedPayload
+    // 同一个SharedPayload可能同时排在很多连接的缓冲区中，不能每个都算一份
+    size_t ownedBytes() const {
+        return readableBytes() - sharedReadable_;
+    }
+
+    // 当前占用的存储字节数（包括已读和未写的部分，不含引用的SharedPayload）
+    size_t storageBytes() const;
+    // 没有可读数据时把存储全部还给池子，下一次写入时再申请
+    void release();
+
     // 从fd上读取/发送数据
     ssize_t readFd(int fd, int* saveErrno);
     ssize_t writeFd(int fd, int* saveErrno);
+    // 最多读取maxBytes字节，用于限制单个连接一次读入的数据量
+    ssize_t readFd(int fd, int* saveErrno, size_t maxBytes);
+    // 最多发送maxBytes字节，用于和其他发送队列（如文件段）保持顺序
+    // flags不为0时改用sendmsg发送，例如MSG_ZEROCOPY
+    ssize_t writeFd(int fd, int* saveErrno, size_t maxBytes, int flags = 0);
+
+    // 把前len字节可读数据所在的块转成引用计数的块，并把引用放进refs
+    // 转换后的块不能再追加或往前写，retrieve之后只要refs还在内存就不会被复用
+    // 只支持分段模式，连续模式返回false
+    bool pin(size_t len, std::vector<BlockRef>* refs);
+    // 交出全部可读数据：每一段的位置放进slices，对应的内存引用放进refs，
+    // 之后缓冲区变为空（存储也一起交出去），引用全部释放后内存才归还
+    void detach(std::vector<Slice>* slices, std::vector<BlockRef>* refs);
 
 private:
-    // 缓冲区定义数组
-    std::vector<char> buffer_;
-    size_t            readerIndex_;
-    size_t            writerIndex_;
+    // 分段模式下的一个块，[readIndex, writeIndex)为可读数据
+    // payload不为空时data指向payload引用的内存（SharedPayload或者pin过的块），
+    // 块没有可写空间，也不需要归还，最后一个引用释放时内存才回收
+    struct Block {
+        char*    data;
+        size_t   size;
+        size_t   readIndex;
+        size_t   writeIndex;
+        BlockRef payload;
+        bool     shared;  // 引用的是SharedPayload，内存不属于这个缓冲区
+
+        char* readPtr() const {
+            return data + readIndex;
+        }
+        char* writePtr() const {
+            return data + writeIndex;
+        }
+        size_t readable() const {
+            return writeIndex - readIndex;
+        }
+    };
+
+    Mode         mode_;
+    BlockPoolPtr pool_;  // 存储来源，为空时使用malloc
+
+    // 缓冲区定义数组，为空时capacity_和两个下标都为0
+    char*  buffer_;
+    size_t capacity_;
+    size_t readerIndex_;
+    size_t writerIndex_;
 
-    // vector底层数组首元素地址，就是数组的起始地址
+    // 分段模式下的块链表，peek()需要合并数据所以是mutable
+    mutable std::deque<Block> blocks_;
+    size_t                    blockSize_;
+    size_t                    readable_;  // 所有块中可读数据的总和
+    mutable size_t            sharedReadable_;  // 其中SharedPayload块的部分
+
+    // 底层数组首元素地址，就是数组的起始地址
     char* begin() {
-        return &*buffer_.begin();
+        return buffer_;
     }
     const char* begin() const {
-        return &*buffer_.begin();
+        return buffer_;
     }
 
     // 申请空间
-    void makeSpace(size_t len) {
-        /**
-         * | kCheapPrepend |xxx| reader | writer |
-         * | kCheapPrepend | reader ｜          len          |
-         **/
-        // xxx标示reader中已读的部分
-        // 如果已读的数据部分（可复用）+可写的部分不够用就得扩容
-        if (writableBytes() + pretendableBytes() < len + kCheapPretend) {
-            buffer_.resize(writerIndex_ + len);
-        } else {
-            size_t readable = readableBytes();
-            // 把未读的数据拷贝并重新置位
-            std::copy(begin() + readerIndex_, begin() + writerIndex_,
-                      begin() + kCheapPretend);
-            readerIndex_ = kCheapPretend;
-            writerIndex_ = readerIndex_ + readable;
-        }
-    }
-};
\ No newline at end of file
+    void makeSpace(size_t len);
+
+    // 从pool_（或malloc）申请/归还内存
+    char* allocate(size_t size, size_t* actual) const;
+    void  deallocate(char* data, size_t size) const;
+    // 把申请来的内存包装成引用，最后一个引用释放时归还
+    BlockRef makeRef(char* data, size_t size) const;
+
+    // 分段模式的实现
+    Block       newBlock(size_t size, size_t index) const;
+    void        freeBlock(const Block& block) const;
+    void        clearBlocks();
+    void        retrieveSegments(size_t len);
+    void        appendSegments(const char* data, size_t len);
+    void        prependSegment(const void* data, size_t len);
+    const char* linearize() const;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+// 在[begin, end)中查找分隔符，找到返回第一个匹配的位置，否则返回nullptr
+// x86_64上按CPU在运行时选择AVX2或SSE2实现，其他平台使用标量实现
+namespace ByteSearch {
+// 查找单个字节，glibc的memchr本身已经按CPU选择了向量实现
+const char* findByte(const char* begin, const char* end, char c);
+// 查找"\r\n"，返回'\r'的位置
+const char* findCRLF(const char* begin, const char* end);
+// 查找set[0, n)中任意一个字节
+const char* findAnyOf(const char* begin, const char* end, const char* set,
+                      size_t n);
+// 当前使用的实现："avx2"、"sse2"或者"scalar"
+const char* implName();
+// 切换到指定的实现，CPU不支持时返回false并保持原来的实现
+// 供测试和基准测试逐个比较各个实现，不是线程安全的，要在开始查找之前调用
+bool useImpl(const char* name);
+}  // namespace ByteSearch
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <stdint.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 
+#include "MpscQueue.h"
+#include "Task.h"
+
 class Buffer;
 class TcpConnection;
 class Timestamp;
 
 using TcpConnectionPtr = std::shared_ptr<TcpConnection>;
-using TimerCallback = std::function<void()>;
+using TimerCallback = Task;
 using ConnectionCallback = std::function<void(const TcpConnectionPtr&)>;
 using CloseCallback = std::function<void(const TcpConnectionPtr&)>;
 using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
@@ -16,6 +21,40 @@ using HighWaterMarkCallback =
     std::function<void(const TcpConnectionPtr&, size_t)>;
 using MessageCallback =
     std::function<void(const TcpConnectionPtr&, Buffer*, Timestamp)>;
+// 超出内存预算的发送被拒绝，len为被丢弃的字节数
+using SendRejectedCallback =
+    std::function<void(const TcpConnectionPtr&, size_t len)>;
+
+// 空闲连接占用的缓冲区字节数，TcpServer给每个loop一个，只由该loop线程修改，
+// 读取时把各个loop的值加起来；前后隔开缓存行，不同loop的计数器互不干扰
+struct IdleBytesCounter {
+    IdleBytesCounter() : bytes(0) {}
+
+    // 只有一个写者，普通的读和写就够了，不需要带lock前缀的原子加
+    void add(int64_t delta) {
+        bytes.store(bytes.load(std::memory_order_relaxed) + delta,
+                    std::memory_order_relaxed);
+    }
+    int64_t get() const {
+        return bytes.load(std::memory_order_relaxed);
+    }
+
+    char                 padBefore[kCacheLineSize];
+    std::atomic<int64_t> bytes;
+    char                 padAfter[kCacheLineSize - sizeof(std::atomic<int64_t>)];
+};
+using IdleBytesCounterPtr = std::shared_ptr<IdleBytesCounter>;
+
+// 零拷贝发送的统计，可以由多个loop上的连接共用
+struct ZeroCopyCounters {
+    ZeroCopyCounters() : sends(0), hits(0), copied(0), fallbacks(0) {}
+
+    std::atomic<int64_t> sends;   // 带MSG_ZEROCOPY的发送次数
+    std::atomic<int64_t> hits;    // 内核通知真正零拷贝完成的次数
+    std::atomic<int64_t> copied;  // 内核回退成拷贝的次数
+    std::atomic<int64_t> fallbacks;  // 超过optmem返回ENOBUFS，改用普通发送的次数
+};
+using ZeroCopyCountersPtr = std::shared_ptr<ZeroCopyCounters>;
 
 static void defaultConnectionCallback(const TcpConnectionPtr& conn);
 static void defaultMessageCallback(const TcpConnectionPtr& conn,
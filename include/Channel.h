@@ -69,16 +69,32 @@ public:
         events_ = kNoneEvent;
         update();
     }
+    // 同时关注读写事件，只需要一次epoll_ctl
+    void enableAll() {
+        events_ |= kReadEvent | kWriteEvent;
+        update();
+    }
+    // 边沿触发（EPOLLET），随下一次注册事件一起生效
+    void setEdgeTriggered(bool on) {
+        if (on) {
+            events_ |= kEdgeTriggered;
+        } else {
+            events_ &= ~kEdgeTriggered;
+        }
+    }
 
     // 返回fd当前状态
     bool isNoneEvent() const {
-        return events_ == kNoneEvent;
+        return (events_ & ~kEdgeTriggered) == kNoneEvent;
     }
     bool isWriting() const {
-        return events_ == kWriteEvent;
+        return events_ & kWriteEvent;
     }
     bool isReading() const {
-        return events_ == kReadEvent;
+        return events_ & kReadEvent;
+    }
+    bool isEdgeTriggered() const {
+        return events_ & kEdgeTriggered;
     }
 
     int index() {
@@ -103,6 +119,7 @@ private:
     static const int kNoneEvent;
     static const int kReadEvent;
     static const int kWriteEvent;
+    static const int kEdgeTriggered;
 
     EventLoop* loop_;     // 事件循环
     const int  fd_;       // fd Poller监听的对象
@@ -15,12 +15,30 @@ public:
     ~EPollPoller() override;
 
     Timestamp poll(int timeoutMs, ChannelList* activeChannels) override;
-    void      updateChannel(Channel* channel) override;
-    void      removeChannel(Channel* channel) override;
+    // 只记录变化，下一次epoll_wait之前按每个fd最终的关注事件调用一次epoll_ctl，
+    // 一轮中先开后关这样互相抵消的变化不会调用epoll_ctl
+    void updateChannel(Channel* channel) override;
+    // 立即从epoll中删除：channel移除之后fd马上会被关闭、复用
+    void  removeChannel(Channel* channel) override;
+    Stats stats() const override;
 
 private:
     static const int kInitEventListSize = 16;
 
+    // 以fd为下标，记录epoll中已经登记的事件
+    struct FdState {
+        FdState()
+            : events(0), registered(false), dirty(false), rearm(false) {}
+
+        int  events;      // 登记在epoll中的事件
+        bool registered;  // 是否已经EPOLL_CTL_ADD
+        bool dirty;       // 在dirtyFds_中
+        bool rearm;  // 边沿触发的channel事件变过又变回来，仍然要MOD一次
+    };
+
+    // 把dirtyFds_中的变化提交给epoll
+    void applyPendingUpdates();
+
     // 填写活跃连接
     void fillActiveChannels(int          numEvents,
                             ChannelList* activeChannels) const;
@@ -31,4 +49,10 @@ private:
 
     int epollfd_;  // epoll_create创建返回的fd
     EventList events_;  // 存放epoll_wait返回的所有发生事件的文件描述符集
+
+    std::vector<FdState> states_;
+    std::vector<int>     dirtyFds_;
+
+    std::atomic<uint64_t> interestChanges_;
+    std::atomic<uint64_t> kernelUpdates_;
 };
\ No newline at end of file
@@ -3,24 +3,28 @@
 #include <atomic>
 #include <functional>
 #include <memory>
-#include <mutex>
 #include <vector>
 
+#include "BlockPool.h"
 #include "Callbacks.h"
 #include "CurrentThread.h"
+#include "MpscQueue.h"
+#include "Poller.h"
+#include "Task.h"
 #include "TimerId.h"
 #include "TimerQueue.h"
 #include "Timestamp.h"
 #include "noncopyable.h"
 
 class Channel;
-class Poller;
+class TimingWheel;
 
 // 事件循环类，主要包含两大模块，Channel Poller
 // 创建了EventLoop的线程就是IO线程，主要功能是EventLoop::loop()
 class EventLoop : noncopyable {
 public:
-    using Functor = std::function<void()>;
+    // 只能移动，绑定shared_ptr和几个参数的std::bind不会申请内存
+    using Functor = Task;
 
     EventLoop();
     ~EventLoop();
@@ -37,7 +41,60 @@ public:
     // 立即唤醒当前loop所在线程并在当前loop中执行cb
     void runInLoop(Functor cb);
     // 把回调函数放入队列，唤醒loop所在的线程执行cb
+    // 在loop线程中调用时放进本地队列，不写eventfd，本轮或者下一轮执行
     void queueInLoop(Functor cb);
+    // 在本轮循环末尾执行cb，此时活跃channel和pendingFunctors_都已经处理完
+    // 只能在loop线程中调用，用于把一轮中多次的操作合并成一次（例如合并写）
+    void runAtIterationEnd(Functor cb);
+
+    // 下一轮循环再执行cb，期间poll不会阻塞；只能在loop线程中调用
+    // 用于单个连接用完本轮的预算之后让出，把剩下的工作留到下一轮
+    void runNextIteration(Functor cb);
+
+    // 公平性预算，0表示不限制；需要在loop线程中或者loop()之前设置
+    // 单个连接每轮最多读取maxBytes字节、最多调用maxReads次read
+    void setReadBudget(size_t maxBytes, int maxReads) {
+        readBudgetBytes_ = maxBytes;
+        readBudgetReads_ = maxReads;
+    }
+    size_t readBudgetBytes() const {
+        return readBudgetBytes_;
+    }
+    int readBudgetReads() const {
+        return readBudgetReads_;
+    }
+    // 每轮最多执行maxCount个pendingFunctors_或者执行maxSeconds秒，
+    // 剩下的按原来的顺序留到下一轮
+    void setFunctorBudget(size_t maxCount, double maxSeconds) {
+        functorBudgetCount_ = maxCount;
+        functorBudgetSeconds_ = maxSeconds;
+    }
+
+    // poll的等待策略，需要在loop线程中或者loop()之前设置
+    enum PollPolicy {
+        kBlocking,       // 没有事件时阻塞在poll中（默认）
+        kBusyPoll,       // 一直用0超时poll，独占一个CPU换取最低的延迟
+        kSpinThenBlock,  // 最后一次有事件之后先空转spinSeconds秒再阻塞
+        kAdaptive,  // 按最近事件的平均间隔决定空转多久，间隔超过spinSeconds时直接阻塞
+    };
+    static constexpr double kDefaultSpinSeconds = 50e-6;
+    void setPollPolicy(PollPolicy policy,
+                       double     spinSeconds = kDefaultSpinSeconds);
+    PollPolicy pollPolicy() const {
+        return pollPolicy_;
+    }
+
+    // 各项预算被用完的次数，可以在其他线程读取
+    struct BudgetStats {
+        uint64_t readBudgetHits;    // 连接一轮读满预算的次数
+        uint64_t functorCountHits;  // pendingFunctors_达到个数上限的轮数
+        uint64_t functorTimeHits;   // pendingFunctors_达到时间上限的轮数
+        uint64_t carriedFunctors;   // 累计留到下一轮执行的回调个数
+    };
+    BudgetStats budgetStats() const;
+    void        countReadBudgetHit() {
+        readBudgetHits_.fetch_add(1, std::memory_order_relaxed);
+    }
 
     // 在time时间点执行回调函数
     TimerId runAt(Timestamp time, TimerCallback cb);
@@ -48,6 +105,10 @@ public:
 
     // 取消时间事件
     void cancel(TimerId timerId);
+
+    // 每秒推进一格的时间轮，用于大量粗粒度的超时（例如连接空闲超时）
+    // 第一次调用时创建，只能在loop线程中使用
+    TimingWheel* timingWheel();
     // 通过eventfd唤醒loop所在线程
     void wakeup();
 
@@ -56,6 +117,18 @@ public:
     void removeChannel(Channel* channel);
     bool hasChannel(Channel* channel);
 
+    // 当前loop上连接缓冲区使用的内存池
+    const BlockPoolPtr& blockPool() const {
+        return blockPool_;
+    }
+    BlockPool::Stats blockPoolStats() const {
+        return blockPool_->stats();
+    }
+    // 关注事件的变化被合并掉了多少次epoll_ctl
+    Poller::Stats pollerStats() const {
+        return poller_->stats();
+    }
+
     // 判断EventLoop对象是否在自己的线程里
     // threadId_为EventLoop创建时的线程id，CurrentThread::tid()为当前线程id
     bool isInLoopThread() const {
@@ -73,8 +146,14 @@ private:
     // 给eventfd返回的文件描述符wakeupFd_绑定的事件回调，当wakeup()时，即有事件发生时
     // 调用handleRead()读取wakeupFd_的 8字节，同时唤醒阻塞的epoll_wait
     void handleRead();
-    // 执行上层的回调函数
-    void doPendingFunctors();
+    // 按等待策略计算这一轮poll的超时时间，准备阻塞时撤销spinning_
+    int pollTimeoutMs();
+    // 这一轮有事件或者回调时调用，更新空转的时间窗口
+    void markActive(Timestamp now);
+    // 执行上层的回调函数，返回是否执行了回调
+    bool doPendingFunctors();
+    // 执行runAtIterationEnd登记的回调
+    void doIterationEndFunctors();
     // 退出不在循环中的线程
     void abortNotInLoopThread();
 
@@ -82,7 +161,6 @@ private:
     // 原子操作，底层通过CAS实现。CAS（Compare-And-Swap）,是一条CPU并发原语，
     // 用于判断内存中某个位置的值是否为预期值，如果是则更改为新的值，这个过程是原子的。
     std::atomic_bool looping_;
-    std::atomic_bool quit_;
 
     const pid_t threadId_;  // 记录当前EventLoop 是被哪一个线程id创建的，
 
@@ -98,13 +176,51 @@ private:
 
     // 定时事件管理器
     std::unique_ptr<TimerQueue> timerQueue_;
+    // 依赖timerQueue_驱动，必须先于它析构
+    std::unique_ptr<TimingWheel> timingWheel_;
+
+    // 该loop上所有连接的Buffer存储都从这里申请
+    BlockPoolPtr blockPool_;
+
+    // 本轮循环末尾要执行的回调，只在loop线程中访问，不需要加锁
+    std::vector<Functor> iterationEndFunctors_;
+    // loop线程自己queueInLoop的回调，不经过无锁队列
+    std::vector<Functor> localFunctors_;
+    // doPendingFunctors中正在执行的回调，作为成员保留容量
+    std::vector<Functor> runningFunctors_;
+
+    // 公平性预算
+    size_t readBudgetBytes_;
+    int    readBudgetReads_;
+    size_t functorBudgetCount_;
+    double functorBudgetSeconds_;
+    // 上一轮超出预算没有执行的回调，下一轮排在pendingFunctors_前面
+    std::vector<Functor> carriedFunctors_;
+    // runNextIteration登记的回调，下一轮poll返回后并入carriedFunctors_
+    std::vector<Functor> nextIterationFunctors_;
+
+    std::atomic<uint64_t> readBudgetHits_;
+    std::atomic<uint64_t> functorCountHits_;
+    std::atomic<uint64_t> functorTimeHits_;
+    std::atomic<uint64_t> carriedFunctorsTotal_;
+
+    // 等待策略
+    PollPolicy pollPolicy_;
+    double     spinSeconds_;
+    Timestamp  lastActiveTime_;  // 最后一次有事件或者回调的时间
+    double     activeGapAvg_;    // 相邻两次有事件的平均间隔（kAdaptive）
+
+    // 下面是其他线程会写的字段，和上面loop线程的状态隔开缓存行
+    char padBefore_[kCacheLineSize];
+
+    // 其他线程调用quit()设置，loop每一轮读一次
+    std::atomic_bool quit_;
 
-    // 标识当前loop是否有需要执行的回调函数
-    std::atomic_bool callingPendingFunctors_;
-
-    // 存储loop需要执行的所有回调操作
-    std::vector<Functor> pendingFunctors_;
+    // 已经写过eventfd、loop还没有开始取回调，期间入队的线程不用再写eventfd
+    std::atomic_bool wakeupPending_;
+    // loop正在用0超时空转，入队的线程不用写eventfd
+    std::atomic_bool spinning_;
 
-    // 互斥锁，用来保护上面vector的线程安全
-    std::mutex mutex_;
+    // 其他线程交给loop执行的回调，任意线程入队，只在loop线程中出队
+    MpscQueue<Functor> pendingFunctors_;
 };
\ No newline at end of file
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <vector>
+
+#include "Poller.h"
+#include "Timestamp.h"
+
+class Channel;
+
+// 实验性的io_uring poll后端，设置了MUDUO_USE_IOURING环境变量时使用，
+// 内核不支持（需要EXT_ARG和multishot poll，5.13以上）时newDefaultPoller退回EPollPoller
+// 只是用IORING_OP_POLL_ADD代替epoll，仍然是就绪通知模型，读写、accept都由
+// TcpConnection和Acceptor自己做系统调用，没有用到io_uring的recv/send/accept：
+// 水平触发的channel用单次poll、每次事件之后重新提交，边沿触发的channel用multishot poll。
+// updateChannel只记录变化，下一次poll()时和等待放在同一次io_uring_enter里提交；
+// removeChannel的撤销马上提交，返回之后内核不再引用这个fd。
+// 超时由IORING_ENTER_EXT_ARG传入，超时为0且没有要提交的请求时直接读完成队列，不进入内核
+// 只使用内核头文件中的定义，不依赖liburing
+class IoUringPoller : public Poller {
+public:
+    IoUringPoller(EventLoop* loop);
+    ~IoUringPoller() override;
+
+    // io_uring_setup或者mmap失败、内核缺少需要的特性时为false
+    bool valid() const {
+        return ringFd_ >= 0;
+    }
+
+    Timestamp poll(int timeoutMs, ChannelList* activeChannels) override;
+    void      updateChannel(Channel* channel) override;
+    void      removeChannel(Channel* channel) override;
+
+private:
+    static const unsigned kRingEntries = 1024;
+
+    // 以fd为下标，记录已经提交给内核的poll
+    struct FdState {
+        FdState()
+            : gen(0),
+              armedEvents(0),
+              multishot(false),
+              dirty(false),
+              rearm(false),
+              active(false),
+              revents(0) {}
+
+        uint32_t gen;  // 每次撤销poll都加一，旧请求的完成事件按gen丢弃
+        uint32_t armedEvents;  // 已经提交的poll关注的事件，0表示没有提交
+        bool     multishot;
+        bool     dirty;   // 在dirtyFds_中，下次poll前要和channel同步
+        bool     rearm;   // 边沿触发的channel事件变过又变回来，仍然要重新提交
+        bool     active;  // 在本次poll的activeFds_中
+        int      revents;
+    };
+
+    bool setupRing();
+    // 用一个管道试提交multishot poll，看内核是否支持
+    bool probeMultishot();
+    void unmapRing();
+
+    FdState& state(int fd) {
+        if (static_cast<size_t>(fd) >= states_.size()) {
+            states_.resize(fd + 1);
+        }
+        return states_[fd];
+    }
+    void markDirty(int fd);
+    // 按channel当前关注的事件提交或者撤销poll
+    void syncFd(int fd);
+
+    io_uring_sqe* getSqe();
+    void          prepPollAdd(int fd, uint32_t events, bool multishot,
+                              uint64_t userData);
+    void          prepPollRemove(uint64_t userData);
+    // 提交准备好的请求，minComplete>0时等待完成事件，timeoutMs<0表示一直等
+    int  enter(unsigned minComplete, int timeoutMs);
+    void handleCompletion(const io_uring_cqe* cqe);
+
+    static uint64_t makeUserData(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    int ringFd_;
+
+    // 提交队列
+    void*         sqRing_;
+    size_t        sqRingSize_;
+    unsigned*     sqHead_;
+    unsigned*     sqTail_;
+    unsigned      sqMask_;
+    unsigned      sqEntries_;
+    unsigned*     sqArray_;
+    io_uring_sqe* sqes_;
+    size_t        sqesSize_;
+    unsigned      sqeTail_;  // 已经准备的请求，提交时写回*sqTail_
+
+    // 完成队列，IORING_FEAT_SINGLE_MMAP时和提交队列共用一块映射
+    void*         cqRing_;
+    size_t        cqRingSize_;
+    unsigned*     cqHead_;
+    unsigned*     cqTail_;
+    unsigned      cqMask_;
+    io_uring_cqe* cqes_;
+
+    std::vector<FdState> states_;
+    std::vector<int>     dirtyFds_;
+    std::vector<int>     activeFds_;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "noncopyable.h"
+
+// 连接缓冲区的内存预算，由一个服务器（或者多个服务器）的所有loop共用
+// 统计所有连接inputBuffer_和outputBuffer_中排队的字节数，
+// 排队的SharedPayload不管被多少个连接引用都只计一次，最后一个引用释放时退还，
+// 超出总预算或者单个连接的预算时按policy处理
+class MemoryBudget : noncopyable {
+public:
+    enum Policy {
+        kStopReading,   // 超出的连接暂停读，直到预算恢复
+        kRejectSend,    // 需要排队的发送直接拒绝，触发SendRejectedCallback
+        kCloseLargest,  // 关闭占用最多的连接，直到总量回到预算之内
+    };
+
+    // limit为所有连接的总预算，connectionLimit为单个连接的预算，0表示不限制
+    MemoryBudget(size_t limit, size_t connectionLimit, Policy policy);
+
+    size_t limit() const {
+        return limit_;
+    }
+    size_t connectionLimit() const {
+        return connectionLimit_;
+    }
+    Policy policy() const {
+        return policy_;
+    }
+
+    // 调整占用的字节数，可以为负
+    void charge(int64_t delta);
+    // 再占用bytes字节（单个连接共占用connectionBytes字节）是否会超出预算
+    bool exceeds(size_t bytes, size_t connectionBytes) const;
+    bool exceeded() const {
+        return limit_ > 0 && usage_ > static_cast<int64_t>(limit_);
+    }
+
+    // 统计计数
+    int64_t usage() const {
+        return usage_;
+    }
+    int64_t peak() const {
+        return peak_;
+    }
+    int64_t pausedReads() const {
+        return pausedReads_;
+    }
+    int64_t rejectedSends() const {
+        return rejectedSends_;
+    }
+    int64_t rejectedBytes() const {
+        return rejectedBytes_;
+    }
+    int64_t forcedCloses() const {
+        return forcedCloses_;
+    }
+
+    void countPausedRead() {
+        ++pausedReads_;
+    }
+    void countRejectedSend(size_t bytes) {
+        ++rejectedSends_;
+        rejectedBytes_ += bytes;
+    }
+    void countForcedClose() {
+        ++forcedCloses_;
+    }
+
+private:
+    const size_t limit_;
+    const size_t connectionLimit_;
+    const Policy policy_;
+
+    std::atomic<int64_t> usage_;
+    std::atomic<int64_t> peak_;
+    std::atomic<int64_t> pausedReads_;
+    std::atomic<int64_t> rejectedSends_;
+    std::atomic<int64_t> rejectedBytes_;
+    std::atomic<int64_t> forcedCloses_;
+};
+
+using MemoryBudgetPtr = std::shared_ptr<MemoryBudget>;
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "noncopyable.h"
+
+// 常见x86_64和ARM64处理器的缓存行大小，用来把不同线程频繁写的字段隔开
+const size_t kCacheLineSize = 64;
+
+// 多生产者单消费者的无锁队列
+// 主体是构造时分配好的环形数组（Dmitry Vyukov的有界队列），每个格子带一个序号：
+// push用一次CAS占住格子，写入元素后更新序号发布；pop只能在唯一的消费者线程调用。
+// 入队出队都在格子里移动元素，不申请内存。
+// 数组满了才退到加锁的溢出队列并置上overflowed_，之后的生产者都进溢出队列，
+// 直到消费者取完数组和溢出队列才清除标志，同一个生产者先后入队的元素不会乱序
+template <typename T>
+class MpscQueue : noncopyable {
+public:
+    static const size_t kDefaultCapacity = 1024;
+
+    // capacity向上取到2的幂
+    explicit MpscQueue(size_t capacity = kDefaultCapacity)
+        : mask_(roundUpPowerOfTwo(capacity) - 1),
+          cells_(new Cell[mask_ + 1]),
+          enqueuePos_(0),
+          overflowed_(false),
+          dequeuePos_(0),
+          draining_(false),
+          batchPos_(0) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscQueue() {
+        T value;
+        while (pop(&value)) {
+        }
+    }
+
+    void push(T&& value) {
+        if (!overflowed_.load(std::memory_order_acquire) && tryPush(value)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        overflow_.push_back(std::move(value));
+        overflowed_.store(true, std::memory_order_release);
+    }
+
+    // 生产者占住格子还没写完时消费者看不到这个元素，pop会暂时返回false，
+    // 调用者需要保证push返回之后还会再pop一次
+    bool pop(T* value) {
+        for (;;) {
+            if (popCell(value)) {
+                return true;
+            }
+            if (!draining_) {
+                if (!overflowed_.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                draining_ = true;
+            }
+            // 置上溢出标志之后数组里剩下的元素都比溢出队列里的早，先取完
+            if (enqueuePos_.load(std::memory_order_acquire) != dequeuePos_) {
+                return false;
+            }
+            if (batchPos_ < batch_.size()) {
+                *value = std::move(batch_[batchPos_++]);
+                return true;
+            }
+            batch_.clear();
+            batchPos_ = 0;
+            std::lock_guard<std::mutex> lock(overflowMutex_);
+            if (overflow_.empty()) {
+                overflowed_.store(false, std::memory_order_release);
+                draining_ = false;
+            } else {
+                batch_.swap(overflow_);
+            }
+        }
+    }
+
+    // 只在消费者线程中有意义
+    bool empty() const {
+        const Cell& cell = cells_[dequeuePos_ & mask_];
+        return cell.seq.load(std::memory_order_acquire) != dequeuePos_ + 1 &&
+               batchPos_ >= batch_.size() &&
+               !overflowed_.load(std::memory_order_acquire);
+    }
+
+private:
+    // seq等于下标时格子空闲，等于下标加一时元素可以取出
+    struct Cell {
+        std::atomic<size_t> seq;
+        T                   value;
+    };
+
+    static size_t roundUpPowerOfTwo(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    bool tryPush(T& value) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell&    cell = cells_[pos & mask_];
+            size_t   seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff =
+                static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // 数组满了
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool popCell(T* value) {
+        Cell& cell = cells_[dequeuePos_ & mask_];
+        if (cell.seq.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+            return false;
+        }
+        *value = std::move(cell.value);
+        cell.seq.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+        ++dequeuePos_;
+        return true;
+    }
+
+    // 构造之后只读
+    const size_t                  mask_;
+    const std::unique_ptr<Cell[]> cells_;
+
+    // 生产者
+    std::atomic<size_t> enqueuePos_;
+    std::atomic_bool    overflowed_;
+
+    // 生产者和消费者各自写自己的字段，隔开放在不同的缓存行里
+    char pad_[kCacheLineSize];
+
+    // 消费者
+    size_t         dequeuePos_;
+    bool           draining_;  // 正在按顺序取溢出队列
+    std::vector<T> batch_;     // 从溢出队列一次取出的元素
+    size_t         batchPos_;
+
+    // 溢出队列只在数组满了的时候使用
+    std::mutex     overflowMutex_;
+    std::vector<T> overflow_;
+};
+
+// 无界的多生产者单消费者侵入式链表，节点由生产者用new分配，带一个next指针
+// push用CAS把节点挂到表头，不加锁、不会满，任何突发都走同一条路径；
+// 消费者用一次exchange取走整条链表，再反转成入队的顺序。
+// 每个实例只占一个指针，适合每个连接一份的场景
+template <typename Node>
+class MpscList : noncopyable {
+public:
+    MpscList() : head_(nullptr) {}
+
+    // 还没取走的节点随链表一起释放
+    ~MpscList() {
+        Node* node = popAll();
+        while (node) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // 接管node，返回true表示入队之前链表是空的，
+    // 调用者据此只在每一批的第一个元素时通知消费者
+    bool push(Node* node) {
+        Node* head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!head_.compare_exchange_weak(head, node,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    // 取走全部节点，按入队的顺序通过next串起来，调用者负责delete
+    Node* popAll() {
+        Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+        Node* prev = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = prev;
+            prev = node;
+            node = next;
+        }
+        return prev;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    std::atomic<Node*> head_;
+};
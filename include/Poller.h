@@ -1,6 +1,7 @@
 #pragma once
 
-#include <unordered_map>
+#include <stdint.h>
+#include <atomic>
 #include <vector>
 
 #include "Timestamp.h"
@@ -28,13 +29,44 @@ public:
     // 判断参数channel是否在当前Poller中
     bool hasChannel(Channel* channel) const;
 
+    // 关注事件的变化次数和实际提交给内核的次数，两者之差是合并掉的系统调用
+    // 可以在其他线程读取；没有统计的实现返回0
+    struct Stats {
+        uint64_t interestChanges;  // updateChannel/removeChannel引起的变化
+        uint64_t kernelUpdates;    // 实际调用epoll_ctl的次数
+    };
+    virtual Stats stats() const {
+        Stats stats = {0, 0};
+        return stats;
+    }
+
     // EventLoop可以通过调用该接口获取默认的IO复用具体实现
     static Poller* newDefaultPoller(EventLoop* loop);
 
 protected:
-    //<sockfd, channelType>
-    using ChannelMap = std::unordered_map<int, Channel*>;
+    // 以fd为下标的channel表，fd总是分配最小的可用整数，所以表是稠密的
+    // 查找、插入、删除都不需要哈希，也不会因为rehash出现延迟尖刺
+    using ChannelMap = std::vector<Channel*>;
+
+    void addChannel(int fd, Channel* channel) {
+        if (static_cast<size_t>(fd) >= channels_.size()) {
+            channels_.resize(fd + 1, nullptr);
+        }
+        if (channels_[fd] == nullptr) {
+            ++numChannels_;
+        }
+        channels_[fd] = channel;
+    }
+    void eraseChannel(int fd) {
+        if (static_cast<size_t>(fd) < channels_.size() &&
+            channels_[fd] != nullptr) {
+            channels_[fd] = nullptr;
+            --numChannels_;
+        }
+    }
+
     ChannelMap channels_;
+    size_t     numChannels_;  // channels_中不为空的个数
 
 private:
     // 定义Poller所属的事件循环EventLoop
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "MemoryBudget.h"
+#include "noncopyable.h"
+
+class SharedPayload;
+using SharedPayloadPtr = std::shared_ptr<const SharedPayload>;
+
+// 不可变、引用计数的待发送数据，用于广播：
+// 编码一次，所有连接的outputBuffer_只持有引用而不拷贝字节，
+// 最后一个连接把它发送完（引用释放）时内存才会回收
+// 排队时只在第一个预算中计一次，不按引用它的连接数重复计算，释放时退还
+class SharedPayload : noncopyable {
+public:
+    explicit SharedPayload(std::string&& data)
+        : data_(std::move(data)), charged_(false) {}
+    SharedPayload(const void* data, size_t len)
+        : data_(static_cast<const char*>(data), len), charged_(false) {}
+    ~SharedPayload() {
+        if (budget_) {
+            budget_->charge(-static_cast<int64_t>(data_.size()));
+        }
+    }
+
+    static SharedPayloadPtr create(std::string&& data) {
+        return std::make_shared<const SharedPayload>(std::move(data));
+    }
+    static SharedPayloadPtr create(const void* data, size_t len) {
+        return std::make_shared<const SharedPayload>(data, len);
+    }
+
+    const char* data() const {
+        return data_.data();
+    }
+    size_t size() const {
+        return data_.size();
+    }
+
+    // 排进连接的缓冲区时调用，可以在多个loop线程中同时调用，
+    // 只有第一次生效并返回true
+    bool chargeTo(const MemoryBudgetPtr& budget) const {
+        // 先读一次，已经计过的payload不用在共享的缓存行上做读改写
+        if (charged_.load(std::memory_order_acquire) ||
+            charged_.exchange(true)) {
+            return false;
+        }
+        budget_ = budget;
+        budget_->charge(static_cast<int64_t>(data_.size()));
+        return true;
+    }
+
+private:
+    const std::string data_;
+    // 析构一定发生在所有引用释放之后，读budget_不需要额外同步
+    mutable std::atomic_bool charged_;
+    mutable MemoryBudgetPtr  budget_;
+};
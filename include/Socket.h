@@ -41,6 +41,8 @@ public:
     void setReusePort(bool on);
     // 开启或关闭SO_KEEPALIVE选项
     void setKeepAlive(bool on);
+    // 开启或关闭SO_ZEROCOPY选项，内核不支持时返回false
+    bool setZeroCopy(bool on);
 
 private:
     const int sockfd_;
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 只能移动的无参回调，EventLoop和TimerQueue中排队的回调都用它保存
+// 不超过kInlineSize字节的可调用对象直接构造在对象内部，入队、移动和执行都不申请内存；
+// 更大的对象才放到堆上。libstdc++的std::function只有16字节的内部存储，
+// 绑定了成员函数和shared_ptr的std::bind都要申请一次内存
+class Task {
+public:
+    static const size_t kInlineSize = 64;
+
+    Task() noexcept : ops_(nullptr) {}
+    Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    // 可以从任意可调用对象隐式构造，和std::function的用法一致
+    // 空的std::function和空函数指针构造出空的Task
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) : ops_(nullptr) {
+        using Fn = typename std::decay<F>::type;
+        if (isNull(f)) {
+            return;
+        }
+        init<Fn>(std::forward<F>(f), FitsInline<Fn>());
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if (ops_ != nullptr) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.ops_ != nullptr) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    // 和std::function一样，const的Task也可以执行，空Task执行时抛出bad_function_call
+    void operator()() const {
+        if (ops_ == nullptr) {
+            throw std::bad_function_call();
+        }
+        ops_->invoke(const_cast<Storage*>(&storage_));
+    }
+
+    explicit operator bool() const noexcept {
+        return ops_ != nullptr;
+    }
+
+private:
+    using Storage =
+        typename std::aligned_storage<kInlineSize, alignof(void*)>::type;
+
+    // 每种可调用对象一张函数表，Task里只保存一个指针
+    struct Ops {
+        void (*invoke)(void* storage);
+        // 把src中的对象移动到dst，并析构src中的对象
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Fn>
+    struct FitsInline
+        : std::integral_constant<
+              bool, sizeof(Fn) <= kInlineSize &&
+                        alignof(Fn) <= alignof(Storage) &&
+                        std::is_nothrow_move_constructible<Fn>::value> {};
+
+    // 对象构造在storage_里
+    template <typename Fn>
+    struct InlineOps {
+        static void invoke(void* storage) {
+            (*static_cast<Fn*>(storage))();
+        }
+        static void move(void* dst, void* src) {
+            Fn* fn = static_cast<Fn*>(src);
+            ::new (dst) Fn(std::move(*fn));
+            fn->~Fn();
+        }
+        static void destroy(void* storage) {
+            static_cast<Fn*>(storage)->~Fn();
+        }
+        static const Ops ops;
+    };
+
+    // storage_里只保存堆上对象的指针，移动时只拷贝指针
+    template <typename Fn>
+    struct HeapOps {
+        static void invoke(void* storage) {
+            (**static_cast<Fn**>(storage))();
+        }
+        static void move(void* dst, void* src) {
+            *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+        }
+        static void destroy(void* storage) {
+            delete *static_cast<Fn**>(storage);
+        }
+        static const Ops ops;
+    };
+
+    template <typename Fn, typename F>
+    void init(F&& f, std::true_type) {
+        ::new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template <typename Fn, typename F>
+    void init(F&& f, std::false_type) {
+        *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    template <typename T>
+    static bool isNull(const T&) {
+        return false;
+    }
+    template <typename T>
+    static bool isNull(T* p) {
+        return p == nullptr;
+    }
+    template <typename Sig>
+    static bool isNull(const std::function<Sig>& f) {
+        return !f;
+    }
+
+    void reset() noexcept {
+        if (ops_ != nullptr) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    const Ops* ops_;
+    Storage    storage_;
+};
+
+template <typename Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {&InlineOps<Fn>::invoke,
+                                            &InlineOps<Fn>::move,
+                                            &InlineOps<Fn>::destroy};
+
+template <typename Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {
+    &HeapOps<Fn>::invoke, &HeapOps<Fn>::move, &HeapOps<Fn>::destroy};
@@ -1,14 +1,23 @@
 #pragma once
 
+#include <sys/types.h>
 #include <atomic>
+#include <deque>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "Buffer.h"
 #include "Callbacks.h"
 #include "InetAddress.h"
 #include "Logger.h"
+#include "MemoryBudget.h"
+#include "MpscQueue.h"
+#include "SharedPayload.h"
 #include "Timestamp.h"
+#include "TimingWheel.h"
 #include "noncopyable.h"
 
 class Channel;
@@ -28,17 +37,29 @@ class TcpConnection : noncopyable,
      * 然后通过其成员函数share_from_this()返回当指向自身的share_ptr。
      **/
 public:
+    // 默认的零拷贝阈值，更小的数据拷贝比等待完成通知更划算
+    static const size_t kZeroCopyThreshold = 64 * 1024;
+    // 边沿触发模式下一次事件最多读写的字节数，超过后让出给其他连接
+    static const size_t kEventByteBudget = 256 * 1024;
+
     TcpConnection(EventLoop* loop, const std::string& nameArg, int sockfd,
                   const InetAddress& localAddr,
                   const InetAddress& peerAddr);
+    // id的高32位是创建者分配的序号，低32位留给创建者自己使用
+    // （TcpServer用来存连接表的槽位）；名字"namePrefix#序号"第一次用到时才拼接
+    TcpConnection(EventLoop* loop, uint64_t id,
+                  const std::shared_ptr<const std::string>& namePrefix,
+                  int sockfd, const InetAddress& localAddr,
+                  const InetAddress& peerAddr);
     ~TcpConnection();
 
     EventLoop* getLoop() const {
         return loop_;
     }
-    const std::string& name() const {
-        return name_;
+    uint64_t id() const {
+        return id_;
     }
+    const std::string& name() const;
     const InetAddress& localAddress() const {
         return localAddr_;
     }
@@ -54,6 +75,48 @@ public:
     void send(const std::string& buf);
     void send(const void* msg, int len);
     void send(Buffer* buf);
+    // 数据移动进跨线程的任务，再以引用的形式挂进outputBuffer_，中间不拷贝字节
+    void send(std::string&& message);
+    void send(Buffer&& buf);
+    // 多段数据不拼接，可写时一次writev发出，只有没发完的尾部才拷贝进outputBuffer_
+    // 例如 conn->send({{&header, sizeof header}, {body.data(), body.size()}});
+    void send(const Slice* slices, size_t count);
+    void send(std::initializer_list<Slice> slices);
+    // 发送共享的不可变数据，没发完的部分在outputBuffer_中只保存引用，
+    // 广播时所有连接共用同一份内存
+    void send(const SharedPayloadPtr& payload);
+
+    // 其他线程的send先暂存，loop一次drain合并成一次发送；
+    // 两个计数之比是每批合并的发送数，可以在其他线程读取
+    uint64_t stagedSendCount() const {
+        return stagedCount_.load(std::memory_order_relaxed);
+    }
+    uint64_t stagedBatchCount() const {
+        return stagedBatches_.load(std::memory_order_relaxed);
+    }
+
+    // 边沿触发：EPOLLIN和EPOLLOUT在连接建立时一次注册，之后不再修改EPOLLOUT，
+    // 每次事件循环读写直到EAGAIN，单次事件超过eventByteBudget字节后
+    // 把剩下的工作排到下一轮，避免一个繁忙的连接饿死同一loop上的其他连接
+    // 读取还受loop的预算限制，见EventLoop::setReadBudget
+    // 需要在connectEstablished之前调用
+    void setEdgeTriggered(bool on, size_t eventByteBudget = kEventByteBudget) {
+        edgeTriggered_ = on;
+        eventByteBudget_ = eventByteBudget;
+    }
+
+    // 合并写：开启后send()只把数据追加到outputBuffer_，本轮循环末尾
+    // （活跃channel和pendingFunctors_都处理完之后）每个连接统一writev一次
+    void setWriteCoalescing(bool on) {
+        coalescing_ = on;
+    }
+    // 立即发送合并写暂存的数据，用于对延迟敏感的路径
+    void flush();
+
+    // 零拷贝发送文件fd中[offset, offset + length)的内容，由EPOLLOUT驱动sendfile(2)
+    // 和之前排队的数据保持顺序，整段发送完才会触发writeCompleteCallback_
+    // 内部会dup一份fd，调用返回后调用者就可以关闭自己的fd
+    void sendFile(int fd, off_t offset, size_t length);
 
     // 关闭连接
     void shutdown();
@@ -77,6 +140,67 @@ public:
         highWaterMark_ = highWaterMark;
     }
 
+    // 读方向的背压：停止/恢复关注EPOLLIN，可以在任意线程调用
+    // 停止读后对端的数据留在内核接收缓冲区，由TCP流控让对端放慢发送
+    void startRead();
+    void stopRead();
+    // 只在loop线程中有意义
+    bool isReading() const {
+        return reading_;
+    }
+
+    // 输入高水位：inputBuffer_积压到highWaterMark字节时自动停止读，
+    // 应用消费了积压的数据之后调用checkInputWaterMark()，
+    // 不超过lowWaterMark时恢复读；highWaterMark为0表示不限制
+    void setInputWaterMark(size_t highWaterMark, size_t lowWaterMark) {
+        inputHighWaterMark_ = highWaterMark;
+        inputLowWaterMark_ = lowWaterMark;
+    }
+    void checkInputWaterMark();
+    // 只能在loop线程中访问
+    Buffer* inputBuffer() {
+        return &inputBuffer_;
+    }
+
+    // 两个缓冲区都排空并空闲seconds秒后把存储还给loop的内存池，<=0表示不释放
+    // 释放由loop的时间轮触发，精度是时间轮的一格
+    // counter统计空闲连接仍然占用的缓冲区字节数，只能是本loop的计数器，可以为空
+    void setIdleBufferRelease(double                     seconds,
+                              const IdleBytesCounterPtr& counter) {
+        bufferReleaseDelay_ = seconds;
+        idleBufferBytes_ = counter;
+    }
+
+    // 没有读到数据也没有发出数据超过seconds秒就强制关闭，<=0表示不限制
+    // 超时挂在loop的时间轮上，收发数据时刷新不需要申请内存
+    // 需要在loop线程或者connectEstablished之前调用
+    void setIdleTimeout(double seconds);
+
+    // 缓冲区中排队的字节计入budget，超出时按budget的策略处理
+    // kCloseLargest策略下总量超出时调用overflowCallback，由服务器挑选要关闭的连接
+    void setMemoryBudget(const MemoryBudgetPtr&       budget,
+                         const std::function<void()>& overflowCallback) {
+        memoryBudget_ = budget;
+        budgetOverflowCallback_ = overflowCallback;
+    }
+    void setSendRejectedCallback(const SendRejectedCallback& cb) {
+        sendRejectedCallback_ = cb;
+    }
+    // 当前计入这个连接预算的字节数，不含排队的SharedPayload，可以在其他线程读取
+    size_t bufferedBytes() const {
+        return chargedBytes_;
+    }
+
+    // 不小于threshold字节的发送使用SO_ZEROCOPY/MSG_ZEROCOPY，0表示关闭
+    // 只对连接自己持有的内存生效：outputBuffer_中排队的数据和SharedPayload，
+    // 发出去的内存一直持有到内核在错误队列上通知发送完成
+    // counters为空时连接单独统计；需要在loop线程或者connectEstablished之前调用
+    void setZeroCopy(size_t                     threshold,
+                     const ZeroCopyCountersPtr& counters = ZeroCopyCountersPtr());
+    const ZeroCopyCountersPtr& zeroCopyCounters() const {
+        return zeroCopyCounters_;
+    }
+
     // //这两个函数应该适应任何类型，目前仅适配FILE类型。将来可以设计any类来曼珠需求
     // const FILE &getContext() const
     // {
@@ -112,13 +236,93 @@ private:
 
     void sendInLoop(const std::string& msg);
     void sendInLoop(const void* data, size_t len);
+    void sendInLoop(const Slice* slices, size_t count);
+    void sendSharedInLoop(const SharedPayloadPtr& payload);
+    void sendRefsInLoop(const std::vector<Slice>&            slices,
+                        const std::vector<Buffer::BlockRef>& refs);
+
+    // 其他线程的一次发送，数据都由引用持有，shared表示引用的是SharedPayload
+    // 只有一段数据时放在slice/ref里，detach出来的多个块才用vector
+    struct StagedSend {
+        StagedSend() : next(nullptr), slice(), shared(false) {}
+
+        StagedSend*                   next;
+        Slice                         slice;
+        Buffer::BlockRef              ref;
+        std::vector<Slice>            slices;
+        std::vector<Buffer::BlockRef> refs;
+        bool                          shared;
+    };
+    // 其他线程的发送先挂到暂存链表上，只有把链表从空变成非空的生产者
+    // 需要排drain任务、唤醒loop，item由链表接管
+    void stageSend(StagedSend* item);
+    // 把暂存的数据合并成一次发送
+    void drainStagedInLoop();
+    // refs不为空时refs[i]保证slices[i]的内存有效，剩余部分按引用排队，
+    // 否则拷贝进outputBuffer_；shared[i]非0表示refs[i]是SharedPayload，
+    // 它不计入这个连接的预算，只在总预算中计一次
+    void sendInLoop(const Slice* slices, size_t count,
+                    const Buffer::BlockRef* refs, const char* shared = nullptr);
+    void sendFileInLoop(int fd, off_t offset, size_t length);
+    // 按顺序发送outputBuffer_和文件段中排队的数据
+    ssize_t writeQueued(int* savedErrno);
+    bool    hasQueuedOutput() const {
+        return outputBuffer_.readableBytes() > 0 || !pendingFiles_.empty();
+    }
     void shutdownInLoop();
     void forceCloseInLoop();
+    // 是否在等待socket可写：水平触发下就是是否注册了EPOLLOUT，
+    // 边沿触发下EPOLLOUT一直注册着，由writeWaiting_记录
+    bool waitingWritable() const;
+    void waitWritable();
+    void cancelWaitWritable();
+    // 边沿触发下单次事件用完字节预算后，剩下的读写排到之后继续
+    void continueReadInLoop();
+    void continueWriteInLoop();
+    void startReadInLoop();
+    void stopReadInLoop();
+    void checkInputWaterMarkInLoop();
+    // 用户没有停止读、没有超出预算、输入没有积压时才关注EPOLLIN
+    void updateReadInterest();
+    // 合并写：本轮末尾发送一次
+    void scheduleFlush();
+    void flushInLoop();
+    // outputBuffer_和文件段都发送完之后的处理
+    void handleOutputDrained();
+
+    // 零拷贝发送：发送成功后持有refs直到内核通知序号seq完成
+    void pinZeroCopy(std::vector<Buffer::BlockRef>* refs);
+    // 读取错误队列上的完成通知，返回是否读到了通知
+    bool handleZeroCopyCompletions();
+    void completeZeroCopy(uint32_t lo, uint32_t hi, bool copied);
+    // 连接销毁时还有没完成的零拷贝发送，保留连接直到通知全部到达
+    void lingerZeroCopyInLoop(int retriesLeft);
+    // 等不到通知的内存不再归还，见实现
+    void abandonZeroCopyPins();
+
+    // 空闲超时
+    void refreshIdleTimer();
+    void handleIdleTimeout();
+
+    // 内存预算
+    void        updateMemoryCharge(bool sharedCharged = false);
+    bool        overBudget() const;
+    void        scheduleBudgetRetry();
+    void        retryBudgetInLoop();
+    static void retryBudget(const std::weak_ptr<TcpConnection>& weakConn);
+
+    // 缓冲区空闲时间统计与释放
+    void markBuffersIdle();
+    void markBuffersActive();
+    void releaseIdleBuffersInLoop();
 
     // 这里是baseLoop还是subLoop由TcpServer中创建的线程数决定
     // 若多为Reactor，此loop_指向subLoop；若为单Reactor，此loop_指向baseLoop
     EventLoop*        loop_;
-    const std::string name_;
+    const uint64_t                     id_;
+    std::shared_ptr<const std::string> namePrefix_;
+    mutable std::string                name_;
+    mutable std::once_flag             nameOnce_;  // 可能在多个线程中读取name()
     std::atomic_int   state_;
     bool              reading_;
 
@@ -139,10 +343,66 @@ private:
     HighWaterMarkCallback highWaterMarkCallback_;
     CloseCallback         closeCallback_;  // 关闭连接的回调
     size_t                highWaterMark_;
+    size_t                inputHighWaterMark_;  // 0表示不限制
+    size_t                inputLowWaterMark_;
+    bool                  inputPaused_;  // 因为输入积压暂停了读
 
-    // 数据缓冲区
+    // 数据缓冲区，都是有数据时才申请存储
     Buffer inputBuffer_;   // 接受数据缓冲区
-    Buffer outputBuffer_;  // 发送数据缓冲区
+    Buffer outputBuffer_;  // 发送数据缓冲区，分段模式
+
+    // 排队等待sendfile的文件段
+    struct FileSegment {
+        int      fd;  // dup出来的fd，整段发送完后关闭
+        off_t    offset;
+        size_t   remaining;
+        uint64_t bufferPos;  // 排在该段之前的outputBuffer_数据在输出流中的结束位置
+    };
+    std::deque<FileSegment> pendingFiles_;
+
+    bool   edgeTriggered_;
+    size_t eventByteBudget_;
+    bool   writeWaiting_;  // 边沿触发下有数据在等EPOLLOUT
+
+    bool coalescing_;      // 开启了合并写
+    bool flushScheduled_;  // 已经登记了本轮末尾的flush
+
+    // 其他线程发送的数据，链表非空就说明已经排了drain任务
+    // 链表没有容量上限，一个连接上的突发发送也不会退到加锁的路径
+    MpscList<StagedSend>  stagedSends_;
+    std::atomic<uint64_t> stagedCount_;    // 累计暂存的发送次数
+    std::atomic<uint64_t> stagedBatches_;  // 累计drain的次数
+    uint64_t outputRetrieved_;  // outputBuffer_中已经发送出去的总字节数
+
+    // 零拷贝发送出去、内核还没有通知完成的内存，序号连续递增
+    struct ZeroCopyPin {
+        uint32_t                      seq;
+        bool                          done;
+        std::vector<Buffer::BlockRef> refs;
+    };
+    size_t                  zeroCopyThreshold_;  // 0表示没有开启
+    uint32_t                zeroCopyNextSeq_;  // 内核给下一次零拷贝发送分配的序号
+    std::deque<ZeroCopyPin> zeroCopyPins_;
+    ZeroCopyCountersPtr     zeroCopyCounters_;
+
+    // 空闲超时
+    double             idleTimeout_;
+    TimingWheel::Entry idleEntry_;
+
+    // 内存预算
+    MemoryBudgetPtr       memoryBudget_;
+    std::function<void()> budgetOverflowCallback_;
+    SendRejectedCallback  sendRejectedCallback_;
+    std::atomic<size_t>   chargedBytes_;  // 已经计入预算的字节数
+    bool                  budgetPaused_;  // 因为超出预算暂停了读
+
+    // 空闲缓冲区释放
+    double              bufferReleaseDelay_;
+    TimingWheel::Entry  bufferReleaseEntry_;  // 挂在loop的时间轮上
+    bool                buffersIdle_;         // 两个缓冲区都已排空
+    Timestamp           idleSince_;
+    size_t              idleHeldBytes_;  // 空闲时仍占用的存储字节数
+    IdleBytesCounterPtr idleBufferBytes_;
 
     // 记录Tcp上下文
 };
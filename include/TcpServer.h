@@ -5,8 +5,9 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include "Acceptor.h"
 #include "Buffer.h"
@@ -14,6 +15,7 @@
 #include "EventLoop.h"
 #include "EventLoopThreadPool.h"
 #include "InetAddress.h"
+#include "MemoryBudget.h"
 #include "TcpConnection.h"
 #include "noncopyable.h"
 
@@ -25,7 +27,10 @@ public:
 
     enum Option {
         kNoReusePort,
-        kReusePort, 
+        kReusePort,
+        // 线程池中的每个loop各自打开一个SO_REUSEPORT的监听socket，
+        // 由内核分散新连接，连接在接受它的loop中直接建立，不经过baseLoop
+        kReusePortPerLoop,
     };
 
     TcpServer(EventLoop* loop, const InetAddress& listenAddr,
@@ -45,31 +50,125 @@ public:
         writeCompleteCallback_ = cb;
     }
 
+    // 连接的两个缓冲区排空并空闲seconds秒后释放存储，<=0表示不释放
+    // 需要在start()之前设置
+    void setIdleBufferRelease(double seconds) {
+        idleBufferReleaseSeconds_ = seconds;
+    }
+    // 所有空闲连接（缓冲区已排空）仍然占用的缓冲区字节数
+    // 每个loop单独计数，这里把各个loop的计数加起来，可以在任意线程调用
+    int64_t idleBufferBytes() const;
+
+    // 连接空闲（没有读到数据也没有发出数据）seconds秒后强制关闭，<=0表示不限制
+    // 由每个loop的时间轮管理，需要在start()之前设置
+    void setIdleTimeout(double seconds) {
+        idleTimeoutSeconds_ = seconds;
+    }
+
+    // 新连接使用边沿触发，见TcpConnection::setEdgeTriggered
+    // 需要在start()之前设置
+    void setEdgeTriggered(
+        bool on, size_t eventByteBudget = TcpConnection::kEventByteBudget) {
+        edgeTriggered_ = on;
+        eventByteBudget_ = eventByteBudget;
+    }
+
+    // 新连接开启合并写，见TcpConnection::setWriteCoalescing
+    void setWriteCoalescing(bool on) {
+        writeCoalescing_ = on;
+    }
+
+    // 连接上不小于threshold字节的发送使用MSG_ZEROCOPY，0表示关闭
+    // 需要在start()之前设置
+    void setZeroCopy(size_t threshold = TcpConnection::kZeroCopyThreshold) {
+        zeroCopyThreshold_ = threshold;
+    }
+    // 所有连接累加的零拷贝统计
+    const ZeroCopyCounters& zeroCopyCounters() const {
+        return *zeroCopyCounters_;
+    }
+
+    // 所有连接缓冲区的内存预算，可以由多个服务器共用；需要在start()之前设置
+    void setMemoryBudget(const MemoryBudgetPtr& budget) {
+        memoryBudget_ = budget;
+    }
+    const MemoryBudgetPtr& memoryBudget() const {
+        return memoryBudget_;
+    }
+    // kRejectSend策略下发送被拒绝时的回调
+    void setSendRejectedCallback(const SendRejectedCallback& cb) {
+        sendRejectedCallback_ = cb;
+    }
+
     // 设置底层subloop的个数
     void setThreadNum(int numThreads);
 
+    // 连接由所属的subloop登记在自己的连接表里，建立和销毁都不经过baseLoop
+    // 下面的接口可以在任意线程调用
+    // 按TcpConnection::id()查找连接，连接已经关闭时返回空
+    TcpConnectionPtr connection(uint64_t id) const;
+    size_t           numConnections() const {
+        return numConnections_;
+    }
+    // 依次对每个loop上的连接调用f，用于统计和广播
+    // 每个连接表只在拷贝快照时加锁，f在锁外执行，可以在f中发送或者关闭连接
+    void forEachConnection(
+        const std::function<void(const TcpConnectionPtr&)>& f) const;
+
     // 开启服务器监听
     void start();
 
 private:
+    struct ConnectionShard;
+
     // 有新连接到来
     void newConnection(int sockfd, const InetAddress& peerAddr);
-    // 移除连接
+    // kReusePortPerLoop模式下，loop自己的监听socket接受了新连接
+    void newConnectionLocal(ConnectionShard* shard, int sockfd,
+                            const InetAddress& peerAddr);
+    // 在选中的subloop中创建连接并登记到该loop的连接表
+    void newConnectionInLoop(ConnectionShard* shard, uint64_t seq,
+                             int sockfd, const InetAddress& peerAddr);
+    // 移除连接，在连接所属的loop中调用
     void removeConnection(const TcpConnectionPtr& conn);
-    // 在当前事件循环移除连接
-    void removeConnectionInLoop(const TcpConnectionPtr& conn);
-
-    // 保存所有连接的map
-    using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
+    // 析构时在shard所属的loop中销毁它的监听socket和连接
+    void destroyShardInLoop(ConnectionShard* shard);
+    // 总量超出预算，关闭占用最多的连接（kCloseLargest）
+    void onBudgetOverflow();
+    void closeLargestConnectionsInLoop();
+
+    // 连接id：高32位是接受连接的序号，接着8位是连接表（loop）的下标，
+    // 低24位是连接表中的槽位；槽位复用后旧的id序号对不上，不会查到新的连接
+    using ConnectionMap = std::vector<TcpConnectionPtr>;
+    static const int      kSeqShift = 32;
+    static const int      kSlotBits = 24;
+    static const uint32_t kSlotMask = (1u << kSlotBits) - 1;
+    static const size_t   kMaxShards = 256;
+
+    // 每个loop一张连接表，登记和删除都在该loop线程中进行，
+    // 锁只在其他线程遍历或查找时才会有竞争
+    struct ConnectionShard {
+        EventLoop*            loop;
+        uint32_t              index;
+        mutable std::mutex    mutex;
+        ConnectionMap         connections;
+        std::vector<uint32_t> freeSlots;
+        // kReusePortPerLoop模式下该loop的监听socket，只在该loop中访问
+        std::unique_ptr<Acceptor> acceptor;
+        // 该loop上空闲连接占用的缓冲区字节数
+        IdleBytesCounterPtr idleBufferBytes;
+    };
 
     // baseloop 用户自定义的loop
     EventLoop* loop_;
 
     const std::string ipPort_;
     const std::string name_;
+    const InetAddress listenAddr_;
+    const bool        acceptPerLoop_;  // kReusePortPerLoop
 
-    std::unique_ptr<Acceptor>
-        acceptor_;  // 运行在mainloop 任务就是监听新连接事件
+    // 运行在mainloop 任务就是监听新连接事件，kReusePortPerLoop模式下为空
+    std::unique_ptr<Acceptor> acceptor_;
 
     std::shared_ptr<EventLoopThreadPool> threadPool_;
 
@@ -81,8 +180,26 @@ private:
 
     std::atomic_int started_;
 
-    // 下一个连接序号
-    int nextConnId_;
+    // 下一个连接序号，kReusePortPerLoop模式下由各个loop并发分配
+    std::atomic<uint64_t> nextConnId_;
+    // 所有连接名字的公共部分"name-ip:port"，连接名字用到时才拼接
+    std::shared_ptr<const std::string> connNamePrefix_;
+
+    double idleBufferReleaseSeconds_;
+
+    double              idleTimeoutSeconds_;
+    bool                edgeTriggered_;
+    size_t              eventByteBudget_;
+    bool                writeCoalescing_;
+    size_t              zeroCopyThreshold_;
+    ZeroCopyCountersPtr zeroCopyCounters_;
+
+    MemoryBudgetPtr      memoryBudget_;
+    SendRejectedCallback sendRejectedCallback_;
+    std::atomic_bool     budgetOverflowPending_;  // 已经安排了一次关闭
 
-    ConnectionMap connections_;  // 保存所有的连接
+    // 保存所有的连接，start()时按线程池的loop创建
+    std::vector<std::unique_ptr<ConnectionShard>> shards_;
+    size_t                                        nextShard_;  // 轮询的下标
+    std::atomic<size_t>                           numConnections_;
 };
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "TimerId.h"
+#include "noncopyable.h"
+
+class EventLoop;
+
+// 哈希时间轮，用来管理大量精度要求不高的超时（例如连接空闲超时）
+// 每tickSeconds秒推进一格，条目按到期格数挂在 deadline % numSlots 的槽里，
+// 调度、刷新和取消都是O(1)，条目由使用者持有，时间轮本身不申请内存。
+// 刷新只更新到期格数，不移动链表节点：槽被扫描到时才把还没到期的条目
+// 挪到新的槽里，所以频繁刷新的条目几乎没有额外开销。
+// 只能在所属loop线程中使用
+class TimingWheel : noncopyable {
+private:
+    // 侵入式双向链表节点，每个槽有一个哨兵节点
+    struct Link {
+        Link* prev;
+        Link* next;
+    };
+
+public:
+    using Callback = std::function<void()>;
+
+    static const size_t kDefaultSlots = 512;
+
+    // 时间轮中的一个超时，通常作为使用者的成员
+    class Entry : noncopyable, private Link {
+    public:
+        explicit Entry(Callback cb);
+        // 析构前应该已经在loop线程中cancel，这里只是兜底
+        ~Entry();
+
+        bool scheduled() const {
+            return wheel_ != nullptr;
+        }
+
+    private:
+        friend class TimingWheel;
+
+        Callback     cb_;
+        TimingWheel* wheel_;     // 挂在哪个时间轮上，没有调度时为nullptr
+        uint64_t     deadline_;  // 到期的格数
+        uint64_t     timeoutTicks_;
+    };
+
+    TimingWheel(EventLoop* loop, double tickSeconds,
+                size_t numSlots = kDefaultSlots);
+    ~TimingWheel();
+
+    // 在seconds秒后执行entry的回调，已经调度过的条目重新计时
+    // 不会早于seconds秒触发，最多晚两格
+    void schedule(Entry* entry, double seconds);
+    // 从现在起重新计时，超时时间不变；只修改到期格数，不移动链表节点
+    void refresh(Entry* entry) {
+        if (entry->wheel_ == this) {
+            entry->deadline_ = currentTick_ + entry->timeoutTicks_;
+        }
+    }
+    void cancel(Entry* entry);
+
+    // 推进一格并执行到期条目的回调，正常由loop的定时器驱动
+    void tick();
+
+    size_t size() const {
+        return size_;
+    }
+    double tickSeconds() const {
+        return tickSeconds_;
+    }
+
+private:
+    static void linkBefore(Link* pos, Link* node) {
+        node->prev = pos->prev;
+        node->next = pos;
+        pos->prev->next = node;
+        pos->prev = node;
+    }
+    static void unlink(Link* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+    }
+
+    Link* slotFor(uint64_t deadline) {
+        return &slots_[deadline % slots_.size()];
+    }
+
+    EventLoop*        loop_;
+    const double      tickSeconds_;
+    std::vector<Link> slots_;
+    uint64_t          currentTick_;
+    size_t            size_;  // 已调度的条目数
+
+    // 有条目时才开启定时器，没有条目时loop不会因为时间轮被唤醒
+    bool    ticking_;
+    TimerId tickTimer_;
+};
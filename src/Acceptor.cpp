@@ -22,7 +22,8 @@ Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr,
                    bool reuseport)
     : loop_(loop),
       acceptSocket_(createNonblocking()),
-      acceptChannel_(loop, acceptSocket_.fd()) {
+      acceptChannel_(loop, acceptSocket_.fd()),
+      listenning_(false) {
     acceptSocket_.setReuseAddr(true);
     acceptSocket_.setReusePort(true);
     acceptSocket_.bindAddress(listenAddr);
@@ -46,23 +47,31 @@ void Acceptor::listen() {
 }
 
 // listenfd有事件发生了，就是有新用户连接
+// 一次事件最多接受kMaxAcceptsPerEvent个连接，连接风暴时不用每个连接都回到poll
 void Acceptor::handleRead() {
-    InetAddress peerAddr;
-    int         connfd = acceptSocket_.accept(&peerAddr);
-    if (connfd >= 0) {
-        if (newConnectionCallback_) {
-            // 轮询找到subLoop并唤醒，分发当前新客户端的Channel
-            // 如何分发？
-            newConnectionCallback_(connfd, peerAddr);
+    for (int i = 0; i < kMaxAcceptsPerEvent; ++i) {
+        InetAddress peerAddr;
+        int         connfd = acceptSocket_.accept(&peerAddr);
+        if (connfd >= 0) {
+            if (newConnectionCallback_) {
+                // 轮询找到subLoop并唤醒，分发当前新客户端的Channel
+                // 如何分发？
+                newConnectionCallback_(connfd, peerAddr);
+            } else {
+                ::close(connfd);
+            }
         } else {
-            ::close(connfd);
-        }
-    } else {
-        LOG_ERROR("%s:%s:%d accept err:%d", __FILE__, __FUNCTION__,
-                  __LINE__, errno);
-        if (errno == EMFILE) { /* Too many open files */
-            LOG_ERROR("%s:%s:%d sockfd reached limit", __FILE__,
-                      __FUNCTION__, __LINE__);
+            // 已经没有等待接受的连接
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            LOG_ERROR("%s:%s:%d accept err:%d", __FILE__, __FUNCTION__,
+                      __LINE__, errno);
+            if (errno == EMFILE) { /* Too many open files */
+                LOG_ERROR("%s:%s:%d sockfd reached limit", __FILE__,
+                          __FUNCTION__, __LINE__);
+            }
+            break;
         }
     }
 }
\ No newline at end of file
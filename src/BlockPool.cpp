@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "BlockPool.h"
+#include "CurrentThread.h"
+#include "Logger.h"
+
+// 在[begin, begin + kArenaChunkSize)中的块是从arena切分出来的
+static bool inChunk(const char* data, const char* chunk) {
+    return data >= chunk && data < chunk + BlockPool::kArenaChunkSize;
+}
+
+// 申请一块按2MB对齐的内存并建议内核使用透明大页
+static char* mapHugePageChunk() {
+    const size_t size = BlockPool::kArenaChunkSize;
+    // 多申请一个chunk的大小，方便对齐到2MB边界
+    void* p = ::mmap(nullptr, size * 2, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    uintptr_t aligned = (start + size - 1) & ~(size - 1);
+    if (aligned > start) {
+        ::munmap(p, aligned - start);
+    }
+    uintptr_t end = start + size * 2;
+    if (end > aligned + size) {
+        ::munmap(reinterpret_cast<void*>(aligned + size),
+                 end - aligned - size);
+    }
+    char* chunk = reinterpret_cast<char*>(aligned);
+    ::madvise(chunk, size, MADV_HUGEPAGE);
+    return chunk;
+}
+
+BlockPool::BlockPool(bool useHugePageArena)
+    : threadId_(CurrentThread::tid()),
+      arenaEnabled_(useHugePageArena),
+      arenaCur_(nullptr),
+      arenaEnd_(nullptr),
+      blocksInUse_(0),
+      blocksFree_(0),
+      highWater_(0),
+      bytesInUse_(0),
+      bytesFree_(0),
+      largeInUse_(0),
+      hasRemoteFree_(false) {
+    for (int i = 0; i < kNumSizeClasses; ++i) {
+        classes_[i].freeList = nullptr;
+        classes_[i].freeCount = 0;
+    }
+}
+
+BlockPool::~BlockPool() {
+    reclaimRemote();
+    // 不在arena中的空闲块是malloc申请的，需要逐个free
+    for (int i = 0; i < kNumSizeClasses; ++i) {
+        FreeNode* node = classes_[i].freeList;
+        while (node) {
+            FreeNode* next = node->next;
+            char*     data = reinterpret_cast<char*>(node);
+            bool      fromArena = false;
+            for (char* chunk : chunks_) {
+                if (inChunk(data, chunk)) {
+                    fromArena = true;
+                    break;
+                }
+            }
+            if (!fromArena) {
+                ::free(data);
+            }
+            node = next;
+        }
+    }
+    for (char* chunk : chunks_) {
+        ::munmap(chunk, kArenaChunkSize);
+    }
+}
+
+// 返回size对应的级别下标，超过kMaxBlockSize返回-1
+int BlockPool::sizeClassOf(size_t size) {
+    int    index = 0;
+    size_t cls = kMinBlockSize;
+    while (cls < size) {
+        cls <<= 1;
+        ++index;
+        if (index >= kNumSizeClasses) {
+            return -1;
+        }
+    }
+    return index;
+}
+
+bool BlockPool::inOwnerThread() const {
+    return threadId_ == CurrentThread::tid();
+}
+
+char* BlockPool::allocate(size_t size, size_t* actual) {
+    int index = sizeClassOf(size);
+    if (index < 0) {
+        // 大块直接走malloc
+        *actual = size;
+        ++largeInUse_;
+        return static_cast<char*>(::malloc(size));
+    }
+
+    const size_t bytes = classSize(index);
+    *actual = bytes;
+    char* data = nullptr;
+
+    if (inOwnerThread()) {
+        if (hasRemoteFree_) {
+            reclaimRemote();
+        }
+        SizeClass& sc = classes_[index];
+        if (sc.freeList) {
+            data = reinterpret_cast<char*>(sc.freeList);
+            sc.freeList = sc.freeList->next;
+            --sc.freeCount;
+            --blocksFree_;
+            bytesFree_ -= bytes;
+        } else if (arenaEnabled_) {
+            data = carve(bytes);
+        }
+    }
+    if (data == nullptr) {
+        data = static_cast<char*>(::malloc(bytes));
+    }
+
+    size_t inUse = ++blocksInUse_;
+    bytesInUse_ += bytes;
+    if (inUse > highWater_) {
+        highWater_ = inUse;
+    }
+    return data;
+}
+
+void BlockPool::deallocate(char* data, size_t size) {
+    if (data == nullptr) {
+        return;
+    }
+    int index = sizeClassOf(size);
+    if (index < 0) {
+        --largeInUse_;
+        ::free(data);
+        return;
+    }
+
+    if (inOwnerThread()) {
+        pushFree(index, data);
+    } else {
+        // 连接可能在其他线程析构，先挂起来等loop线程回收
+        std::unique_lock<std::mutex> lock(mutex_);
+        remoteFree_.push_back(std::make_pair(data, size));
+        hasRemoteFree_ = true;
+    }
+}
+
+BlockPool::Stats BlockPool::stats() const {
+    Stats s;
+    s.blocksInUse = blocksInUse_;
+    s.blocksFree = blocksFree_;
+    s.highWater = highWater_;
+    s.bytesInUse = bytesInUse_;
+    s.bytesFree = bytesFree_;
+    s.largeInUse = largeInUse_;
+    return s;
+}
+
+// 从当前arena chunk中切出一块，chunk用完再映射一个新的
+char* BlockPool::carve(size_t size) {
+    if (arenaCur_ == nullptr || arenaCur_ + size > arenaEnd_) {
+        char* chunk = mapHugePageChunk();
+        if (chunk == nullptr) {
+            LOG_ERROR("BlockPool::carve mmap hugepage chunk failed, "
+                      "fallback to malloc");
+            arenaEnabled_ = false;
+            return nullptr;
+        }
+        // 上一个chunk剩下的零头丢弃不用，级别都是2的幂所以最多浪费不到64KB
+        chunks_.push_back(chunk);
+        arenaCur_ = chunk;
+        arenaEnd_ = chunk + kArenaChunkSize;
+    }
+    char* data = arenaCur_;
+    arenaCur_ += size;
+    return data;
+}
+
+void BlockPool::pushFree(int index, char* data) {
+    const size_t bytes = classSize(index);
+    --blocksInUse_;
+    bytesInUse_ -= bytes;
+
+    SizeClass& sc = classes_[index];
+    if (chunks_.empty() &&
+        (sc.freeCount + 1) * bytes > kMaxFreeBytesPerClass) {
+        ::free(data);
+        return;
+    }
+    FreeNode* node = reinterpret_cast<FreeNode*>(data);
+    node->next = sc.freeList;
+    sc.freeList = node;
+    ++sc.freeCount;
+    ++blocksFree_;
+    bytesFree_ += bytes;
+}
+
+void BlockPool::reclaimRemote() {
+    std::vector<std::pair<char*, size_t>> blocks;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        blocks.swap(remoteFree_);
+        hasRemoteFree_ = false;
+    }
+    for (const auto& b : blocks) {
+        pushFree(sizeClassOf(b.second), b.first);
+    }
+}
@@ -1,8 +1,463 @@
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
 #include "Buffer.h"
+#include "ByteSearch.h"
+
+// 分段模式下没有任何块时peek()返回的地址
+static const char kEmptyData[Buffer::kCheapPretend] = {0};
+
+// writev一次最多提交的块数
+static const int kMaxIov = IOV_MAX;
+
+Buffer::Buffer(size_t initialSize, const BlockPoolPtr& pool)
+    : mode_(kContiguous),
+      pool_(pool),
+      buffer_(nullptr),
+      capacity_(0),
+      readerIndex_(kCheapPretend),
+      writerIndex_(kCheapPretend),
+      blockSize_(kBlockSize),
+      readable_(0),
+      sharedReadable_(0) {
+    if (initialSize > 0) {
+        buffer_ = allocate(kCheapPretend + initialSize, &capacity_);
+    } else {
+        readerIndex_ = 0;
+        writerIndex_ = 0;
+    }
+}
+
+Buffer::Buffer(Mode mode, size_t blockSize, const BlockPoolPtr& pool)
+    : mode_(mode),
+      pool_(pool),
+      buffer_(nullptr),
+      capacity_(0),
+      readerIndex_(kCheapPretend),
+      writerIndex_(kCheapPretend),
+      blockSize_(blockSize),
+      readable_(0),
+      sharedReadable_(0) {
+    if (mode_ == kContiguous) {
+        buffer_ = allocate(kCheapPretend + kInitialSize, &capacity_);
+    }
+}
+
+Buffer::Buffer(const Buffer& rhs)
+    : mode_(rhs.mode_),
+      buffer_(nullptr),
+      capacity_(0),
+      readerIndex_(rhs.readerIndex_),
+      writerIndex_(rhs.writerIndex_),
+      blockSize_(rhs.blockSize_),
+      readable_(rhs.readable_),
+      sharedReadable_(rhs.sharedReadable_) {
+    if (rhs.buffer_) {
+        buffer_ = allocate(rhs.capacity_, &capacity_);
+        ::memcpy(buffer_ + readerIndex_, rhs.buffer_ + readerIndex_,
+                 writerIndex_ - readerIndex_);
+    }
+    for (const Block& b : rhs.blocks_) {
+        if (b.payload) {
+            blocks_.push_back(b);  // 不可变的数据直接共享引用
+            continue;
+        }
+        Block block = newBlock(b.size, b.readIndex);
+        block.writeIndex = b.writeIndex;
+        ::memcpy(block.readPtr(), b.readPtr(), b.readable());
+        blocks_.push_back(block);
+    }
+}
+
+Buffer::Buffer(Buffer&& rhs) noexcept
+    : mode_(rhs.mode_),
+      pool_(std::move(rhs.pool_)),
+      buffer_(rhs.buffer_),
+      capacity_(rhs.capacity_),
+      readerIndex_(rhs.readerIndex_),
+      writerIndex_(rhs.writerIndex_),
+      blocks_(std::move(rhs.blocks_)),
+      blockSize_(rhs.blockSize_),
+      readable_(rhs.readable_),
+      sharedReadable_(rhs.sharedReadable_) {
+    // rhs变成没有任何存储的空缓冲区，下一次写入时再申请
+    rhs.blocks_.clear();
+    rhs.buffer_ = nullptr;
+    rhs.capacity_ = 0;
+    rhs.readerIndex_ = 0;
+    rhs.writerIndex_ = 0;
+    rhs.readable_ = 0;
+    rhs.sharedReadable_ = 0;
+}
+
+Buffer& Buffer::operator=(Buffer rhs) {
+    swap(rhs);
+    return *this;
+}
+
+Buffer::~Buffer() {
+    clearBlocks();
+    deallocate(buffer_, capacity_);
+}
+
+void Buffer::swap(Buffer& rhs) noexcept {
+    std::swap(mode_, rhs.mode_);
+    pool_.swap(rhs.pool_);
+    std::swap(buffer_, rhs.buffer_);
+    std::swap(capacity_, rhs.capacity_);
+    std::swap(readerIndex_, rhs.readerIndex_);
+    std::swap(writerIndex_, rhs.writerIndex_);
+    blocks_.swap(rhs.blocks_);
+    std::swap(blockSize_, rhs.blockSize_);
+    std::swap(readable_, rhs.readable_);
+    std::swap(sharedReadable_, rhs.sharedReadable_);
+}
+
+void Buffer::retrieveAll() {
+    if (segmented()) {
+        // 只保留一个自己的块留作后续复用，其余全部释放
+        while (blocks_.size() > 1 ||
+               (!blocks_.empty() && blocks_.back().payload)) {
+            freeBlock(blocks_.back());
+            blocks_.pop_back();
+        }
+        if (!blocks_.empty()) {
+            blocks_.front().readIndex = kCheapPretend;
+            blocks_.front().writeIndex = kCheapPretend;
+        }
+        readable_ = 0;
+        sharedReadable_ = 0;
+        return;
+    }
+    if (buffer_) {
+        readerIndex_ = kCheapPretend;
+        writerIndex_ = kCheapPretend;
+    }
+}
+
+// 分段模式下peek()会先合并数据，一般只有inputBuffer_（连续模式）需要查找
+const char* Buffer::findCRLF(size_t hint) const {
+    const char* begin = peek();
+    // "\r"可能是上一次扫描的最后一个字节，回退一个字节
+    hint = std::min(hint > 0 ? hint - 1 : 0, readableBytes());
+    return ByteSearch::findCRLF(begin + hint, begin + readableBytes());
+}
+
+const char* Buffer::findEOL(size_t hint) const {
+    return findByte('\n', hint);
+}
+
+const char* Buffer::findByte(char c, size_t hint) const {
+    const char* begin = peek();
+    hint = std::min(hint, readableBytes());
+    return ByteSearch::findByte(begin + hint, begin + readableBytes(), c);
+}
+
+const char* Buffer::findAnyOf(const char* set, size_t n, size_t hint) const {
+    const char* begin = peek();
+    hint = std::min(hint, readableBytes());
+    return ByteSearch::findAnyOf(begin + hint, begin + readableBytes(), set,
+                                 n);
+}
+
+void Buffer::appendVarUint64(uint64_t x) {
+    // 先编码到栈上，只调用一次append
+    char   buf[kMaxVarintBytes];
+    size_t n = 0;
+    while (x >= 0x80) {
+        buf[n++] = static_cast<char>(x | 0x80);
+        x >>= 7;
+    }
+    buf[n++] = static_cast<char>(x);
+    append(buf, n);
+}
+
+int Buffer::peekVarUint64(uint64_t* x) const {
+    const size_t readable = readableBytes();
+    if (readable == 0) {
+        return 0;
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(peek());
+    if (p[0] < 0x80) {
+        *x = p[0];
+        return 1;
+    }
+    if (readable >= sizeof(uint64_t)) {
+        // 一次取8个字节，最高位为0的第一个字节就是结束字节，不用逐字节判断
+        uint64_t word = 0;
+        ::memcpy(&word, p, sizeof word);
+        word = le64toh(word);
+        const uint64_t stops = ~word & 0x8080808080808080ULL;
+        if (stops != 0) {
+            const int n = __builtin_ctzll(stops) / 8 + 1;
+            uint64_t  result = 0;
+            for (int i = 0; i < n; ++i) {
+                result |= ((word >> (8 * i)) & 0x7f) << (7 * i);
+            }
+            *x = result;
+            return n;
+        }
+    }
+    // 超过8字节的大数或者数据不足8字节，逐字节解码
+    uint64_t result = 0;
+    for (size_t i = 0; i < kMaxVarintBytes && i < readable; ++i) {
+        // 第10个字节只剩最高1位可用，更大的值溢出了uint64_t
+        if (i == kMaxVarintBytes - 1 && p[i] > 1) {
+            return -1;
+        }
+        result |= static_cast<uint64_t>(p[i] & 0x7f) << (7 * i);
+        if (p[i] < 0x80) {
+            *x = result;
+            return static_cast<int>(i + 1);
+        }
+    }
+    return readable >= kMaxVarintBytes ? -1 : 0;
+}
+
+size_t Buffer::storageBytes() const {
+    if (segmented()) {
+        size_t bytes = 0;
+        for (const Block& b : blocks_) {
+            if (!b.payload) {
+                bytes += b.size;
+            }
+        }
+        return bytes;
+    }
+    return capacity_;
+}
+
+void Buffer::release() {
+    if (readableBytes() > 0) {
+        return;
+    }
+    clearBlocks();
+    deallocate(buffer_, capacity_);
+    buffer_ = nullptr;
+    capacity_ = 0;
+    readerIndex_ = 0;
+    writerIndex_ = 0;
+}
+
+std::string Buffer::retrieveAsString(size_t len) {
+    std::string result;
+    if (segmented()) {
+        // 逐块拷贝，不需要先合并成连续内存
+        len = std::min(len, readable_);
+        result.reserve(len);
+        size_t left = len;
+        for (const Block& b : blocks_) {
+            if (left == 0) {
+                break;
+            }
+            size_t n = std::min(left, b.readable());
+            result.append(b.readPtr(), n);
+            left -= n;
+        }
+    } else {
+        result.assign(peek(), len);
+    }
+    // 已经读出缓冲区中数据，所以复位缓冲区
+    retrieve(len);
+    return result;
+}
+
+void Buffer::makeSpace(size_t len) {
+    if (segmented()) {
+        // 尾块剩余空间不够时直接挂一个新块，原有数据不动
+        size_t index = blocks_.empty() ? kCheapPretend : 0;
+        blocks_.push_back(newBlock(std::max(blockSize_, len + index), index));
+        return;
+    }
+    /**
+     * | kCheapPrepend |xxx| reader | writer |
+     * | kCheapPrepend | reader ｜          len          |
+     **/
+    // xxx标示reader中已读的部分
+    // 如果已读的数据部分（可复用）+可写的部分不够用就得扩容
+    if (writableBytes() + pretendableBytes() < len + kCheapPretend) {
+        // 扩容时至少翻倍，同时把未读数据挪到kCheapPretend处
+        size_t readable = readableBytes();
+        size_t capacity = 0;
+        // 第一次申请存储时至少申请kInitialSize
+        size_t size = std::max(kCheapPretend + readable + len,
+                               buffer_ ? capacity_ * 2
+                                       : kCheapPretend + kInitialSize);
+        char*  buf = allocate(size, &capacity);
+        if (buffer_) {
+            ::memcpy(buf + kCheapPretend, peek(), readable);
+        }
+        deallocate(buffer_, capacity_);
+        buffer_ = buf;
+        capacity_ = capacity;
+        readerIndex_ = kCheapPretend;
+        writerIndex_ = readerIndex_ + readable;
+    } else {
+        size_t readable = readableBytes();
+        // 把未读的数据拷贝并重新置位
+        std::copy(begin() + readerIndex_, begin() + writerIndex_,
+                  begin() + kCheapPretend);
+        readerIndex_ = kCheapPretend;
+        writerIndex_ = readerIndex_ + readable;
+    }
+}
+
+char* Buffer::allocate(size_t size, size_t* actual) const {
+    if (pool_) {
+        return pool_->allocate(size, actual);
+    }
+    *actual = size;
+    return static_cast<char*>(::malloc(size));
+}
+
+void Buffer::deallocate(char* data, size_t size) const {
+    if (data == nullptr) {
+        return;
+    }
+    if (pool_) {
+        pool_->deallocate(data, size);
+    } else {
+        ::free(data);
+    }
+}
+
+// 块的实际大小可能比size大（向上取整到池子的级别）
+Buffer::Block Buffer::newBlock(size_t size, size_t index) const {
+    Block block;
+    block.data = allocate(size, &block.size);
+    block.readIndex = index;
+    block.writeIndex = index;
+    block.shared = false;
+    return block;
+}
+
+// 引用SharedPayload的块随着Block对象析构释放引用
+void Buffer::freeBlock(const Block& block) const {
+    if (!block.payload) {
+        deallocate(block.data, block.size);
+    }
+}
+
+void Buffer::clearBlocks() {
+    for (const Block& b : blocks_) {
+        freeBlock(b);
+    }
+    blocks_.clear();
+    readable_ = 0;
+    sharedReadable_ = 0;
+}
+
+// 从头部开始消费len字节，读完的块直接释放
+void Buffer::retrieveSegments(size_t len) {
+    if (len >= readable_) {
+        retrieveAll();
+        return;
+    }
+    readable_ -= len;
+    while (len > 0) {
+        Block& head = blocks_.front();
+        size_t n = head.readable();
+        if (len < n) {
+            head.readIndex += len;
+            if (head.shared) {
+                sharedReadable_ -= len;
+            }
+            break;
+        }
+        len -= n;
+        if (head.shared) {
+            sharedReadable_ -= n;
+        }
+        freeBlock(head);
+        blocks_.pop_front();
+    }
+}
+
+void Buffer::appendSegments(const char* data, size_t len) {
+    readable_ += len;
+    while (len > 0) {
+        if (writableBytes() == 0) {
+            makeSpace(1);
+        }
+        Block& tail = blocks_.back();
+        size_t n = std::min(len, tail.size - tail.writeIndex);
+        ::memcpy(tail.writePtr(), data, n);
+        tail.writeIndex += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void Buffer::appendShared(const SharedPayloadPtr& payload, size_t offset) {
+    if (offset >= payload->size()) {
+        return;
+    }
+    const size_t len = payload->size() - offset;
+    appendRef(payload, payload->data() + offset, len);
+    if (segmented()) {
+        blocks_.back().shared = true;
+        sharedReadable_ += len;
+    }
+}
+
+void Buffer::appendRef(const BlockRef& ref, const char* data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (!segmented()) {
+        append(data, len);
+        return;
+    }
+    Block block;
+    block.data = const_cast<char*>(data);
+    block.size = len;
+    block.readIndex = 0;
+    block.writeIndex = len;
+    block.payload = ref;
+    block.shared = false;
+    blocks_.push_back(block);
+    readable_ += len;
+}
+
+void Buffer::prependSegment(const void* data, size_t len) {
+    if (pretendableBytes() < len) {
+        // 头块前面放不下，在最前面挂一个新块，数据放在块的末尾
+        Block block = newBlock(std::max(blockSize_, len), 0);
+        block.readIndex = block.size;
+        block.writeIndex = block.size;
+        blocks_.push_front(block);
+    }
+    Block& head = blocks_.front();
+    head.readIndex -= len;
+    ::memcpy(head.readPtr(), data, len);
+    readable_ += len;
+}
+
+// 把所有可读数据合并到一个块中，返回其起始地址
+const char* Buffer::linearize() const {
+    if (blocks_.empty()) {
+        return kEmptyData;
+    }
+    if (blocks_.size() > 1) {
+        Block block = newBlock(std::max(blockSize_, readable_ + kCheapPretend),
+                               kCheapPretend);
+        for (const Block& b : blocks_) {
+            ::memcpy(block.writePtr(), b.readPtr(), b.readable());
+            block.writeIndex += b.readable();
+            freeBlock(b);
+        }
+        blocks_.clear();
+        blocks_.push_back(block);
+        sharedReadable_ = 0;  // 已经拷贝成自己的数据
+    }
+    return blocks_.front().readPtr();
+}
 
 /**
  * 从fd上读取数据 Poller工作在LT模式
@@ -14,6 +469,10 @@
  **/
 
 ssize_t Buffer::readFd(int fd, int* saveErrno) {
+    return readFd(fd, saveErrno, SIZE_MAX);
+}
+
+ssize_t Buffer::readFd(int fd, int* saveErrno, size_t maxBytes) {
     // 栈额外空间，用来从套接字往外读时，当 buffer_ 暂时不够用时暂存数据
     // 栈上内存空间 65536/1024 = 64KB
     char extrabuf[65536] = {0};
@@ -27,30 +486,50 @@ ssize_t Buffer::readFd(int fd, int* saveErrno) {
      };
     */
 
+    // 分段模式下先保证有一个自己的尾块，数据直接读进块里，
+    // 下面更新尾块的writeIndex时blocks_也不会为空
+    if (segmented() && writableBytes() == 0) {
+        makeSpace(1);
+    }
+
     // 使用iovec分配两个连续的缓冲区
     struct iovec vec[2];
     // Buffer底层缓冲区剩余的可写空间大小，不一定能完全存储从fd读出的数据
     const size_t writable = writableBytes();
 
     // 第一块缓冲区，指向可写空间
-    vec[0].iov_base = begin() + writerIndex_;
-    vec[0].iov_len = writable;
+    // 受maxBytes限制时读到的数据不会超过writable，按下面第一个分支处理
+    vec[0].iov_base = beginWrite();
+    vec[0].iov_len = std::min(writable, maxBytes);
     // 第二块缓冲区，指向栈空间
     vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof(extrabuf);
+    vec[1].iov_len = std::min(sizeof(extrabuf), maxBytes - vec[0].iov_len);
 
     // 当buffer有足够空间时，不读取栈空间
     // 当需要栈空间时，最多读取128K-1个字节
-    const int iovcnt =
-        (writable < sizeof(extrabuf) ? 2 : 1);  // 控制buffer最大为64KB
+    const int iovcnt = (writable < sizeof(extrabuf) && vec[1].iov_len > 0
+                            ? 2
+                            : 1);  // 控制buffer最大为64KB
     const ssize_t n = ::readv(fd, vec, iovcnt);  // 读进去！
 
     if (n < 0) {  // 读出错，记录错误代码
         *saveErrno = errno;
     } else if (n <= writable) {  // Buffer的可写缓冲区已经够存储读出来的数据
-        writerIndex_ += n;
+        if (segmented()) {
+            blocks_.back().writeIndex += n;
+            readable_ += n;
+        } else {
+            writerIndex_ += n;
+        }
     } else {  // extrabuf里面也写入了n-writable长度的数据
-        writerIndex_ = buffer_.size();
+        if (segmented()) {
+            if (writable > 0) {
+                blocks_.back().writeIndex = blocks_.back().size;
+                readable_ += writable;
+            }
+        } else {
+            writerIndex_ = capacity_;
+        }
         append(
             extrabuf,
             n - writable);  // 对buffer_扩容，并将extrabuf存储的另一部分数据追加至buffer_
@@ -60,10 +539,113 @@ ssize_t Buffer::readFd(int fd, int* saveErrno) {
 
 // inputBuffer_.readFd表示将对端数据读到inputBuffer_中，移动writerIndex_指针
 // outputBuffer_.writeFd标示将数据写入到outputBuffer_中，从readerIndex_开始，可以写readableBytes()个字节
+// 分段模式下把各个块组织成iovec，一次writev最多发送IOV_MAX个块
 ssize_t Buffer::writeFd(int fd, int* saveErrno) {
-    ssize_t n = ::write(fd, peek(), readableBytes());
+    return writeFd(fd, saveErrno, readableBytes());
+}
+
+ssize_t Buffer::writeFd(int fd, int* saveErrno, size_t maxBytes, int flags) {
+    ssize_t n = 0;
+    maxBytes = std::min(maxBytes, readableBytes());
+    if (segmented() || flags != 0) {
+        struct iovec vec[kMaxIov];
+        int          iovcnt = 0;
+        size_t       left = maxBytes;
+        if (!segmented() && maxBytes > 0) {
+            vec[iovcnt].iov_base = const_cast<char*>(peek());
+            vec[iovcnt].iov_len = maxBytes;
+            ++iovcnt;
+        }
+        for (const Block& b : blocks_) {
+            if (iovcnt == kMaxIov || left == 0) {
+                break;
+            }
+            if (b.readable() > 0) {
+                vec[iovcnt].iov_base = b.readPtr();
+                vec[iovcnt].iov_len = std::min(left, b.readable());
+                left -= vec[iovcnt].iov_len;
+                ++iovcnt;
+            }
+        }
+        if (iovcnt == 0) {
+            n = 0;
+        } else if (flags != 0) {
+            struct msghdr msg;
+            ::memset(&msg, 0, sizeof msg);
+            msg.msg_iov = vec;
+            msg.msg_iovlen = iovcnt;
+            n = ::sendmsg(fd, &msg, flags);
+        } else {
+            n = ::writev(fd, vec, iovcnt);
+        }
+    } else {
+        n = ::write(fd, peek(), maxBytes);
+    }
     if (n < 0) {
         *saveErrno = errno;
     }
     return n;
-}
\ No newline at end of file
+}
+
+bool Buffer::pin(size_t len, std::vector<BlockRef>* refs) {
+    if (!segmented()) {
+        return false;
+    }
+    len = std::min(len, readable_);
+    for (Block& b : blocks_) {
+        if (len == 0) {
+            break;
+        }
+        if (b.readable() == 0) {
+            continue;
+        }
+        if (!b.payload) {
+            b.payload = makeRef(b.data, b.size);
+            // 关闭剩余的可写空间，后续追加写到新块中
+            b.size = b.writeIndex;
+        }
+        refs->push_back(b.payload);
+        len -= std::min(len, b.readable());
+    }
+    return true;
+}
+
+void Buffer::detach(std::vector<Slice>* slices, std::vector<BlockRef>* refs) {
+    if (!segmented()) {
+        if (readableBytes() > 0) {
+            Slice slice = {buffer_ + readerIndex_, readableBytes()};
+            slices->push_back(slice);
+            refs->push_back(makeRef(buffer_, capacity_));
+            // 存储已经交给引用，下一次写入时重新申请
+            buffer_ = nullptr;
+            capacity_ = 0;
+            readerIndex_ = 0;
+            writerIndex_ = 0;
+        }
+        return;
+    }
+    for (Block& b : blocks_) {
+        if (b.readable() == 0) {
+            continue;
+        }
+        if (!b.payload) {
+            b.payload = makeRef(b.data, b.size);
+        }
+        Slice slice = {b.readPtr(), b.readable()};
+        slices->push_back(slice);
+        refs->push_back(b.payload);
+    }
+    clearBlocks();
+}
+
+// 引用同时持有池子，池子会比所有引用活得更久
+Buffer::BlockRef Buffer::makeRef(char* data, size_t size) const {
+    BlockPoolPtr pool = pool_;
+    return BlockRef(data, [pool, size](char* p) {
+        if (pool) {
+            pool->deallocate(p, size);
+        } else {
+            ::free(p);
+        }
+    });
+}
@@ -0,0 +1,224 @@
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "ByteSearch.h"
+
+namespace {
+
+using FindCRLFFunc = const char* (*)(const char*, const char*);
+using FindAnyOfFunc = const char* (*)(const char*, const char*, const char*,
+                                      size_t);
+
+// 向量实现中每个字节都要和集合中的字节比较一次，集合太大时用查表的标量实现
+const size_t kMaxVectorSet = 16;
+
+const char* findCRLFScalar(const char* begin, const char* end) {
+    const char* p = begin;
+    while (end - p >= 2) {
+        p = static_cast<const char*>(::memchr(p, '\r', end - p - 1));
+        if (p == nullptr) {
+            return nullptr;
+        }
+        if (p[1] == '\n') {
+            return p;
+        }
+        ++p;
+    }
+    return nullptr;
+}
+
+const char* findAnyOfScalar(const char* begin, const char* end,
+                            const char* set, size_t n) {
+    bool table[256] = {false};
+    for (size_t i = 0; i < n; ++i) {
+        table[static_cast<unsigned char>(set[i])] = true;
+    }
+    for (const char* p = begin; p < end; ++p) {
+        if (table[static_cast<unsigned char>(*p)]) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+#if defined(__x86_64__)
+
+// 同时比较p和p+1开始的16字节，分别匹配'\r'和'\n'，两者都命中的位置就是CRLF
+const char* findCRLFSse2(const char* begin, const char* end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const char*   p = begin;
+    while (end - p >= 17) {
+        __m128i  a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i  b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf))));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return findCRLFScalar(p, end);
+}
+
+const char* findAnyOfSse2(const char* begin, const char* end,
+                          const char* set, size_t n) {
+    if (n > kMaxVectorSet) {
+        return findAnyOfScalar(begin, end, set, n);
+    }
+    __m128i needles[kMaxVectorSet];
+    for (size_t i = 0; i < n; ++i) {
+        needles[i] = _mm_set1_epi8(set[i]);
+    }
+    const char* p = begin;
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i eq = _mm_setzero_si128();
+        for (size_t i = 0; i < n; ++i) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, needles[i]));
+        }
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return findAnyOfScalar(p, end, set, n);
+}
+
+__attribute__((target("avx2"))) const char* findCRLFAvx2(const char* begin,
+                                                          const char* end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const char*   p = begin;
+    while (end - p >= 33) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i b =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, cr),
+                             _mm256_cmpeq_epi8(b, lf))));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return findCRLFSse2(p, end);
+}
+
+__attribute__((target("avx2"))) const char* findAnyOfAvx2(const char* begin,
+                                                           const char* end,
+                                                           const char* set,
+                                                           size_t      n) {
+    if (n > kMaxVectorSet) {
+        return findAnyOfScalar(begin, end, set, n);
+    }
+    __m256i needles[kMaxVectorSet];
+    for (size_t i = 0; i < n; ++i) {
+        needles[i] = _mm256_set1_epi8(set[i]);
+    }
+    const char* p = begin;
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i eq = _mm256_setzero_si256();
+        for (size_t i = 0; i < n; ++i) {
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, needles[i]));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return findAnyOfSse2(p, end, set, n);
+}
+
+#endif  // __x86_64__
+
+struct Impl {
+    FindCRLFFunc  findCRLF;
+    FindAnyOfFunc findAnyOf;
+    const char*   name;
+};
+
+Impl selectImpl() {
+#if defined(__x86_64__)
+    // x86_64一定支持SSE2，只需要检测AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        Impl impl = {findCRLFAvx2, findAnyOfAvx2, "avx2"};
+        return impl;
+    }
+    Impl impl = {findCRLFSse2, findAnyOfSse2, "sse2"};
+    return impl;
+#else
+    Impl impl = {findCRLFScalar, findAnyOfScalar, "scalar"};
+    return impl;
+#endif
+}
+
+// 第一次使用时检测一次CPU，C++11保证局部静态变量的初始化是线程安全的
+Impl& impl() {
+    static Impl selected = selectImpl();
+    return selected;
+}
+
+}  // namespace
+
+namespace ByteSearch {
+
+const char* findByte(const char* begin, const char* end, char c) {
+    if (begin >= end) {
+        return nullptr;
+    }
+    return static_cast<const char*>(::memchr(begin, c, end - begin));
+}
+
+const char* findCRLF(const char* begin, const char* end) {
+    if (end - begin < 2) {
+        return nullptr;
+    }
+    return impl().findCRLF(begin, end);
+}
+
+const char* findAnyOf(const char* begin, const char* end, const char* set,
+                      size_t n) {
+    if (begin >= end || n == 0) {
+        return nullptr;
+    }
+    if (n == 1) {
+        return findByte(begin, end, set[0]);
+    }
+    return impl().findAnyOf(begin, end, set, n);
+}
+
+const char* implName() {
+    return impl().name;
+}
+
+bool useImpl(const char* name) {
+    if (::strcmp(name, "scalar") == 0) {
+        Impl scalar = {findCRLFScalar, findAnyOfScalar, "scalar"};
+        impl() = scalar;
+        return true;
+    }
+#if defined(__x86_64__)
+    if (::strcmp(name, "sse2") == 0) {
+        Impl sse2 = {findCRLFSse2, findAnyOfSse2, "sse2"};
+        impl() = sse2;
+        return true;
+    }
+    __builtin_cpu_init();
+    if (::strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        Impl avx2 = {findCRLFAvx2, findAnyOfAvx2, "avx2"};
+        impl() = avx2;
+        return true;
+    }
+#endif
+    return false;
+}
+
+}  // namespace ByteSearch
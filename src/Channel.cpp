@@ -8,6 +8,7 @@ const int Channel::kNoneEvent = 0;
 const int Channel::kReadEvent =
     EPOLLIN | EPOLLPRI;  // 连接建立；有数据到达；带外数据
 const int Channel::kWriteEvent = EPOLLOUT;
+const int Channel::kEdgeTriggered = EPOLLET;
 
 Channel::Channel(EventLoop* loop, int fd)
     : loop_(loop),
@@ -50,7 +51,7 @@ void Channel::handleEvent(Timestamp receiveTime) {
 }
 
 void Channel::handleEventWithGuard(Timestamp receiveTime) {
-    LOG_INFO("channel handleEvent revents:%d", revents_);
+    LOG_DEBUG("channel handleEvent revents:%d", revents_);
     // 当TcpConnection对应的Channel通过shutdown关闭写端，epoll触发EPOLLHUP
     if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN)) {
         if (closeCallback_) {
@@ -1,5 +1,7 @@
-#include "Poller.h"
 #include "EPollPoller.h"
+#include "IoUringPoller.h"
+#include "Logger.h"
+#include "Poller.h"
 
 #include <stdlib.h>
 
@@ -8,8 +10,14 @@ Poller* Poller::newDefaultPoller(EventLoop* loop) {
     //{
     //     return new PollPoller(loop);
     // }
-    // else
-    //{
+    if (::getenv("MUDUO_USE_IOURING")) {
+        IoUringPoller* poller = new IoUringPoller(loop);
+        if (poller->valid()) {
+            return poller;
+        }
+        // 内核不支持或者被seccomp禁用时退回epoll
+        delete poller;
+        LOG_ERROR("io_uring unavailable, fall back to epoll");
+    }
     return new EPollPoller(loop);
-    //}
 }
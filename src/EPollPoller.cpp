@@ -17,7 +17,9 @@ const int kDeleted = 2;
 EPollPoller::EPollPoller(EventLoop* loop)
     : Poller(loop),
       epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
-      events_(kInitEventListSize) {
+      events_(kInitEventListSize),
+      interestChanges_(0),
+      kernelUpdates_(0) {
     if (epollfd_ < 0) {
         LOG_FATAL("epoll_create error:%d", errno);
     }
@@ -30,7 +32,9 @@ EPollPoller::~EPollPoller() {
 Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels) {
     // poll频繁调用，用DEBUG比较合适
     LOG_DEBUG("func=%s => fd total count:%1u", __FUNCTION__,
-              channels_.size());
+              numChannels_);
+
+    applyPendingUpdates();
 
     int numEvents =
         ::epoll_wait(epollfd_, &*events_.begin(),
@@ -65,37 +69,89 @@ void EPollPoller::updateChannel(Channel* channel) {
     // channel是新来的或者已经删除过的
     if (index == kNew || index == kDeleted) {
         if (index == kNew) {
-            int fd = channel->fd();
-            channels_[fd] = channel;
-        } else {
+            addChannel(channel->fd(), channel);
         }
         channel->set_index(kAdded);
-        update(EPOLL_CTL_ADD, channel);
-    } else {  // 已经在Poller中了
-        int fd = channel->fd();
-        if (channel->isNoneEvent()) {
-            update(EPOLL_CTL_DEL, channel);
-            channel->set_index(kDeleted);
-        } else {
-            update(EPOLL_CTL_MOD, channel);
-        }
+    } else if (channel->isNoneEvent()) {  // 已经在Poller中了
+        channel->set_index(kDeleted);
+    }
+
+    // 只标记，epoll_wait之前再和epoll中登记的事件比较
+    interestChanges_.fetch_add(1, std::memory_order_relaxed);
+    int fd = channel->fd();
+    if (static_cast<size_t>(fd) >= states_.size()) {
+        states_.resize(fd + 1);
+    }
+    FdState& state = states_[fd];
+    if (!state.dirty) {
+        state.dirty = true;
+        dirtyFds_.push_back(fd);
+    }
+    // 边沿触发下停止读又恢复读，合并之后和登记的事件相同，但暂停期间留在内核里的
+    // 数据不会再产生边沿；MOD时epoll会重新检查一次就绪状态，所以仍然要提交
+    if (channel->isEdgeTriggered() && state.registered &&
+        channel->events() != state.events) {
+        state.rearm = true;
     }
 }
 
 // 从Poller中删除channel
 void EPollPoller::removeChannel(Channel* channel) {
     int fd = channel->fd();
-    channels_.erase(fd);
+    eraseChannel(fd);
 
     LOG_INFO("func=%s => fd=%d\n", __FUNCTION__, fd);
 
     int index = channel->index();
     if (index == kAdded) {
+        interestChanges_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 登记过的fd马上删除，不能等到fd被关闭、复用之后；
+    // 还没有提交过的channel（例如刚建立就关闭的连接）不需要调用epoll_ctl
+    if (static_cast<size_t>(fd) < states_.size() &&
+        states_[fd].registered) {
         update(EPOLL_CTL_DEL, channel);
+        states_[fd].registered = false;
+        states_[fd].events = 0;
     }
     channel->set_index(kNew);
 }
 
+void EPollPoller::applyPendingUpdates() {
+    for (int fd : dirtyFds_) {
+        FdState&   state = states_[fd];
+        const bool rearm = state.rearm;
+        state.dirty = false;
+        state.rearm = false;
+        Channel* channel = channels_[fd];
+        // removeChannel已经处理过被移除的channel
+        if (channel == nullptr) {
+            continue;
+        }
+        int wanted = channel->index() == kAdded ? channel->events() : 0;
+        if (state.registered) {
+            if (wanted == 0) {
+                update(EPOLL_CTL_DEL, channel);
+                state.registered = false;
+            } else if (wanted != state.events || rearm) {
+                update(EPOLL_CTL_MOD, channel);
+            }
+        } else if (wanted != 0) {
+            update(EPOLL_CTL_ADD, channel);
+            state.registered = true;
+        }
+        state.events = wanted;
+    }
+    dirtyFds_.clear();
+}
+
+EPollPoller::Stats EPollPoller::stats() const {
+    Stats stats;
+    stats.interestChanges = interestChanges_.load(std::memory_order_relaxed);
+    stats.kernelUpdates = kernelUpdates_.load(std::memory_order_relaxed);
+    return stats;
+}
+
 // 填写活跃链接
 void EPollPoller::fillActiveChannels(int          numEvents,
                                      ChannelList* activeChannels) const {
@@ -118,6 +174,7 @@ void EPollPoller::update(int operation, Channel* channel) {
     // event.data.fd = fd;
     event.data.ptr = channel;
 
+    kernelUpdates_.fetch_add(1, std::memory_order_relaxed);
     if (::epoll_ctl(epollfd_, operation, fd, &event) < 0) {
         if (operation == EPOLL_CTL_DEL) {
             LOG_ERROR("epoll_ctl del error:%d", errno);
@@ -2,11 +2,15 @@
 #include "Channel.h"
 #include "Logger.h"
 #include "Poller.h"
+#include "TimingWheel.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 //__thread是GCC内置的线程局部存储措施，__thread修饰的变量在每个线程中有一份独立实例，各个线程的值互不干扰。
@@ -18,6 +22,9 @@ __thread EventLoop* t_loopInThisThread = nullptr;
 // 定义默认的Poller IO复用接口的超时时间10s
 const int kPollTimeMs = 10000;
 
+// 时间轮每格的时长，空闲超时一类的场景秒级精度就够了
+const double kTimingWheelTickSeconds = 1.0;
+
 // 通过eventfd在线程之间传递数据的好处是多个线程之间不需要上锁就可以实现同步。
 // 函数原型 int eventfd(unsigned int initval,int flags)
 // eventfd可以用于同一个进程之中线程之间的通信，可用于亲缘进程之间的通信
@@ -36,14 +43,29 @@ int createEventfd() {
 
 EventLoop::EventLoop()
     : looping_(false),
-      quit_(false),
-      callingPendingFunctors_(false),
       threadId_(CurrentThread::tid()),
       poller_(Poller::newDefaultPoller(this)),
       wakeupFd_(createEventfd()),
       wakeupChannel_(new Channel(this, wakeupFd_)),
+      activeChannels_(NULL),
       timerQueue_(new TimerQueue(this)),
-      activeChannels_(NULL) {
+      // 设置了MUDUO_HUGEPAGE_ARENA环境变量时内存池从透明大页中切分块
+      blockPool_(std::make_shared<BlockPool>(
+          ::getenv("MUDUO_HUGEPAGE_ARENA") != nullptr)),
+      readBudgetBytes_(0),
+      readBudgetReads_(0),
+      functorBudgetCount_(0),
+      functorBudgetSeconds_(0),
+      readBudgetHits_(0),
+      functorCountHits_(0),
+      functorTimeHits_(0),
+      carriedFunctorsTotal_(0),
+      pollPolicy_(kBlocking),
+      spinSeconds_(kDefaultSpinSeconds),
+      activeGapAvg_(0),
+      quit_(false),
+      wakeupPending_(false),
+      spinning_(false) {
     LOG_DEBUG("EventLoop created %p in thread %d", this, threadId_);
     if (t_loopInThisThread) {
         LOG_FATAL("Another EventLoop %p exists in this thread %d",
@@ -77,7 +99,16 @@ void EventLoop::loop() {
 
     while (!quit_) {
         activeChannels_.clear();
-        pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+        // 有留到这一轮的工作时poll不阻塞，只收集已经就绪的事件
+        const bool carried = !carriedFunctors_.empty() ||
+                             !nextIterationFunctors_.empty() ||
+                             !localFunctors_.empty();
+        pollReturnTime_ =
+            poller_->poll(carried ? 0 : pollTimeoutMs(), &activeChannels_);
+        for (Functor& functor : nextIterationFunctors_) {
+            carriedFunctors_.push_back(std::move(functor));
+        }
+        nextIterationFunctors_.clear();
         for (auto channel : activeChannels_) {
             // Poller监听到哪些channel发生了事件 然后上报给EventLoop
             // 通知channel处理相应事件
@@ -92,7 +123,13 @@ void EventLoop::loop() {
         // mainloop调用queueInLoop将回调加入subloop（该回调需要subloop执行
         // 但subloop还在poller_->poll处阻塞）
         // queueInLoop通过wakeup将subloop唤醒
-        doPendingFunctors();
+        const bool ranFunctors = doPendingFunctors();
+        if (!activeChannels_.empty() || ranFunctors) {
+            markActive(pollReturnTime_);
+        }
+
+        // 本轮中被标记的连接在这里统一发送，每个连接只写一次
+        doIterationEndFunctors();
     }
     LOG_INFO("EventLoop %p stop looping.", this);
     looping_ = false;
@@ -119,23 +156,31 @@ void EventLoop::runInLoop(Functor cb) {
     if (isInLoopThread()) {  // 在当前线程执行回调
         cb();
     } else {  // 在非EventLoop线程中执行cb,就需要唤醒EventLoop所在线程执行cb
-        queueInLoop(cb);
+        queueInLoop(std::move(cb));
     }
 }
 
 // 把回调函数放入队列 唤醒loop所在的线程执行cb
 void EventLoop::queueInLoop(Functor cb) {
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        pendingFunctors_.emplace_back(cb);
+    // loop线程自己加入的回调：在处理活跃channel时加入的本轮执行，
+    // 在执行回调时加入的下一轮执行，loop()看到本地队列不空时poll不会阻塞
+    if (isInLoopThread()) {
+        localFunctors_.push_back(std::move(cb));
+        return;
     }
 
-    // callingPendingFunctors的意思是 当前loop正在执行回调中
-    // 但是loop的pendingFunctors_中又加入了新的回调
+    pendingFunctors_.push(std::move(cb));
+
+    // loop在空转时下一次poll就会取到，不需要写eventfd
+    // 和pollTimeoutMs中的顺序配对：先入队再检查spinning_
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (spinning_.load(std::memory_order_relaxed)) {
+        return;
+    }
     // 需要通过wakeup写事件，唤醒相应的需要执行上面回调操作的loop的线程
-    // 让loop()下一次poller_->poll()不再阻塞（阻塞的话会延迟前一次新加入的回调的执行）
-    // 然后继续执行pendingFunctors_中的回调函数
-    if (!isInLoopThread() || callingPendingFunctors_) {
+    // loop取回调之前只需要唤醒一次：wakeupPending_已经置上时，
+    // 写eventfd的线程或者loop自己清除标志之后一定会再取一次队列
+    if (!wakeupPending_.exchange(true, std::memory_order_acq_rel)) {
         wakeup();  // 唤醒loop所在的线程
     }
 }
@@ -171,24 +216,135 @@ void EventLoop::handleRead() {
     }
 }
 
+void EventLoop::setPollPolicy(PollPolicy policy, double spinSeconds) {
+    pollPolicy_ = policy;
+    spinSeconds_ = spinSeconds;
+    activeGapAvg_ = 0;
+    lastActiveTime_ = Timestamp::now();
+    spinning_ = policy == kBusyPoll;
+}
+
+int EventLoop::pollTimeoutMs() {
+    if (pollPolicy_ == kBlocking) {
+        return kPollTimeMs;
+    }
+    if (pollPolicy_ == kBusyPoll) {
+        return 0;
+    }
+
+    double window = spinSeconds_;
+    if (pollPolicy_ == kAdaptive) {
+        // 事件平均间隔比上限短时空转两个间隔，否则空转也等不到，直接阻塞
+        window = activeGapAvg_ < spinSeconds_
+                     ? std::min(2 * activeGapAvg_, spinSeconds_)
+                     : 0;
+    }
+    if (timeDifference(Timestamp::now(), lastActiveTime_) < window) {
+        if (!spinning_.load(std::memory_order_relaxed)) {
+            spinning_.store(true, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+    if (spinning_.load(std::memory_order_relaxed)) {
+        // 空转期间入队的线程没有写eventfd，阻塞之前再检查一次队列
+        spinning_.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pendingFunctors_.empty()) {
+            return 0;
+        }
+    }
+    return kPollTimeMs;
+}
+
+void EventLoop::markActive(Timestamp now) {
+    if (pollPolicy_ == kAdaptive) {
+        // 指数滑动平均，最近的间隔占1/8
+        double gap = timeDifference(now, lastActiveTime_);
+        activeGapAvg_ += (gap - activeGapAvg_) / 8;
+    }
+    lastActiveTime_ = now;
+}
+
 // 执行上层的回调函数
-void EventLoop::doPendingFunctors() {
-    std::vector<Functor> functors;
-    callingPendingFunctors_ = true;
+bool EventLoop::doPendingFunctors() {
+    std::vector<Functor>& functors = runningFunctors_;
+
+    // 先清除标志再取队列：之后入队的线程会重新唤醒loop，
+    // 之前入队的回调这里一定能取到（exchange和生产者的exchange同步）
+    wakeupPending_.exchange(false, std::memory_order_acq_rel);
 
-    {
-        // 交换的方式减少了锁的临界区范围，提升效率，同时避免了死锁
-        // 如果执行functor()在临界区内
-        // 且functor()中调用queueInLoop()就会产生死锁
-        std::unique_lock<std::mutex> lock(mutex_);
-        functors.swap(pendingFunctors_);
+    // 上一轮剩下的回调排在前面，保持执行顺序
+    // 先取出再执行，执行中queueInLoop的回调留到下一轮
+    functors.swap(carriedFunctors_);
+    for (Functor& functor : localFunctors_) {
+        functors.push_back(std::move(functor));
+    }
+    localFunctors_.clear();
+    Functor functor;
+    while (pendingFunctors_.pop(&functor)) {
+        functors.push_back(std::move(functor));
     }
 
-    for (const Functor& functor : functors) {
-        functor();  // 执行当前loop所需要执行的回调操作
+    const bool timed = functorBudgetSeconds_ > 0;
+    Timestamp  start = timed ? Timestamp::now() : Timestamp();
+    size_t     i = 0;
+    for (; i < functors.size(); ++i) {
+        if (functorBudgetCount_ > 0 && i >= functorBudgetCount_) {
+            functorCountHits_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        // 至少执行一个，保证每一轮都有进展
+        if (timed && i > 0 &&
+            timeDifference(Timestamp::now(), start) >= functorBudgetSeconds_) {
+            functorTimeHits_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        functors[i]();  // 执行当前loop所需要执行的回调操作
+    }
+    if (i < functors.size()) {
+        carriedFunctorsTotal_.fetch_add(functors.size() - i,
+                                        std::memory_order_relaxed);
+        carriedFunctors_.assign(
+            std::make_move_iterator(functors.begin() + i),
+            std::make_move_iterator(functors.end()));
     }
+    functors.clear();
+    return i > 0;
+}
+
+void EventLoop::runNextIteration(Functor cb) {
+    nextIterationFunctors_.push_back(std::move(cb));
+}
 
-    callingPendingFunctors_ = false;
+EventLoop::BudgetStats EventLoop::budgetStats() const {
+    BudgetStats stats;
+    stats.readBudgetHits = readBudgetHits_.load(std::memory_order_relaxed);
+    stats.functorCountHits =
+        functorCountHits_.load(std::memory_order_relaxed);
+    stats.functorTimeHits = functorTimeHits_.load(std::memory_order_relaxed);
+    stats.carriedFunctors =
+        carriedFunctorsTotal_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void EventLoop::runAtIterationEnd(Functor cb) {
+    iterationEndFunctors_.push_back(std::move(cb));
+}
+
+void EventLoop::doIterationEndFunctors() {
+    if (iterationEndFunctors_.empty()) {
+        return;
+    }
+    // 回调中queueInLoop的任务（例如writeCompleteCallback）进入本地队列，
+    // 下一轮poll不会阻塞住它们
+    std::vector<Functor>& functors = runningFunctors_;
+    while (!iterationEndFunctors_.empty()) {
+        functors.swap(iterationEndFunctors_);
+        for (const Functor& functor : functors) {
+            functor();
+        }
+        functors.clear();
+    }
 }
 
 TimerId EventLoop::runAt(Timestamp time, TimerCallback cb) {
@@ -209,6 +365,13 @@ void EventLoop::cancel(TimerId timerId) {
     return timerQueue_->cancel(timerId);
 }
 
+TimingWheel* EventLoop::timingWheel() {
+    if (!timingWheel_) {
+        timingWheel_.reset(new TimingWheel(this, kTimingWheelTickSeconds));
+    }
+    return timingWheel_.get();
+}
+
 void EventLoop::abortNotInLoopThread() {
     LOG_FATAL("EventLoop::abortNotInLoopThread - EventLoop %p was created "
               "in threadId_ = %d , current thread id = %d",
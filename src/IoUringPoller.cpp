@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Channel.h"
+#include "IoUringPoller.h"
+#include "Logger.h"
+
+// 和EPollPoller相同的channel状态
+const int kNew = -1;
+const int kAdded = 1;
+const int kDeleted = 2;
+
+namespace {
+
+// 撤销请求本身的完成事件不需要处理，fd不可能是0xffffffff
+const uint64_t kIgnoredUserData = ~static_cast<uint64_t>(0);
+
+// 用户态和内核共享的队列指针，需要带内存序访问
+inline unsigned loadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+inline void storeRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags, const void* arg, size_t argSize) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit,
+                                      minComplete, flags, arg, argSize));
+}
+
+}  // namespace
+
+IoUringPoller::IoUringPoller(EventLoop* loop)
+    : Poller(loop),
+      ringFd_(-1),
+      sqRing_(MAP_FAILED),
+      sqRingSize_(0),
+      sqHead_(nullptr),
+      sqTail_(nullptr),
+      sqMask_(0),
+      sqEntries_(0),
+      sqArray_(nullptr),
+      sqes_(nullptr),
+      sqesSize_(0),
+      sqeTail_(0),
+      cqRing_(MAP_FAILED),
+      cqRingSize_(0),
+      cqHead_(nullptr),
+      cqTail_(nullptr),
+      cqMask_(0),
+      cqes_(nullptr) {
+    if (!setupRing()) {
+        unmapRing();
+        if (ringFd_ >= 0) {
+            ::close(ringFd_);
+            ringFd_ = -1;
+        }
+    }
+}
+
+IoUringPoller::~IoUringPoller() {
+    unmapRing();
+    if (ringFd_ >= 0) {
+        ::close(ringFd_);
+    }
+}
+
+bool IoUringPoller::setupRing() {
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    ringFd_ = ioUringSetup(kRingEntries, &params);
+    if (ringFd_ < 0) {
+        LOG_ERROR("io_uring_setup error:%d", errno);
+        return false;
+    }
+    // 等待超时依赖EXT_ARG（5.11），multishot poll在5.13之后才有，映射好之后再探测
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        LOG_ERROR("io_uring lacks IORING_FEAT_EXT_ARG");
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap && cqRingSize_ > sqRingSize_) {
+        sqRingSize_ = cqRingSize_;
+    }
+    sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        LOG_ERROR("io_uring mmap sq ring error:%d", errno);
+        return false;
+    }
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ =
+            ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            LOG_ERROR("io_uring mmap cq ring error:%d", errno);
+            return false;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG_ERROR("io_uring mmap sqes error:%d", errno);
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ =
+        *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqeTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // 单次poll模拟不了边沿触发：一直可写的socket每次重新提交都会立即完成，
+    // loop永远不会阻塞，所以不支持multishot的内核（5.11、5.12）直接退回epoll
+    if (!probeMultishot()) {
+        LOG_ERROR("io_uring lacks multishot poll");
+        return false;
+    }
+    return true;
+}
+
+bool IoUringPoller::probeMultishot() {
+    int pipefd[2];
+    if (::pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_ERROR("io_uring probe pipe error:%d", errno);
+        return false;
+    }
+    // 空管道的写端一直可写，提交之后马上就有完成事件
+    prepPollAdd(pipefd[1], EPOLLOUT, true, kIgnoredUserData);
+    bool supported = false;
+    if (enter(1, -1) >= 0 && loadAcquire(cqTail_) != *cqHead_) {
+        const io_uring_cqe* cqe = &cqes_[*cqHead_ & cqMask_];
+        supported = cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE);
+        storeRelease(cqHead_, *cqHead_ + 1);
+    }
+    if (supported) {
+        // 撤销探测用的poll，之后的完成事件按kIgnoredUserData丢弃
+        prepPollRemove(kIgnoredUserData);
+        enter(0, 0);
+    }
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+    return supported;
+}
+
+void IoUringPoller::unmapRing() {
+    if (sqes_ != nullptr) {
+        ::munmap(sqes_, sqesSize_);
+        sqes_ = nullptr;
+    }
+    if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+        ::munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_ != MAP_FAILED) {
+        ::munmap(sqRing_, sqRingSize_);
+    }
+    sqRing_ = MAP_FAILED;
+    cqRing_ = MAP_FAILED;
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList* activeChannels) {
+    LOG_DEBUG("func=%s => fd total count:%lu", __FUNCTION__, numChannels_);
+
+    // 把上一轮记录的变化和需要重新提交的poll一起准备好
+    for (int fd : dirtyFds_) {
+        states_[fd].dirty = false;
+        syncFd(fd);
+    }
+    dirtyFds_.clear();
+
+    const bool ready = loadAcquire(cqTail_) != *cqHead_;
+    if (!ready && timeoutMs != 0) {
+        int ret = enter(1, timeoutMs);
+        if (ret < 0 && ret != -EINTR && ret != -ETIME) {
+            errno = -ret;
+            LOG_ERROR("IoUringPoller::poll() error!");
+        }
+    } else if (sqeTail_ != loadAcquire(sqHead_)) {
+        enter(0, 0);
+    }
+    Timestamp now(Timestamp::now());
+
+    unsigned head = *cqHead_;
+    unsigned tail = loadAcquire(cqTail_);
+    for (; head != tail; ++head) {
+        handleCompletion(&cqes_[head & cqMask_]);
+    }
+    storeRelease(cqHead_, head);
+
+    // 同一个fd的多个完成事件合并成一次
+    for (int fd : activeFds_) {
+        FdState& st = states_[fd];
+        st.active = false;
+        Channel* channel = channels_[fd];
+        if (channel != nullptr) {
+            channel->set_revents(st.revents);
+            activeChannels->push_back(channel);
+        }
+        st.revents = 0;
+    }
+    if (!activeFds_.empty()) {
+        LOG_DEBUG("%lu events happened", activeFds_.size());
+    }
+    activeFds_.clear();
+    return now;
+}
+
+void IoUringPoller::handleCompletion(const io_uring_cqe* cqe) {
+    if (cqe->user_data == kIgnoredUserData) {
+        return;
+    }
+    const int      fd = static_cast<int>(cqe->user_data & 0xffffffff);
+    const uint32_t gen = static_cast<uint32_t>(cqe->user_data >> 32);
+    if (static_cast<size_t>(fd) >= states_.size() ||
+        states_[fd].gen != gen || fd >= static_cast<int>(channels_.size()) ||
+        channels_[fd] == nullptr) {
+        return;  // 已经撤销或者fd已经被复用
+    }
+    FdState& st = states_[fd];
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // 单次poll已经完成，或者multishot被内核终止，下次poll前重新提交
+        st.armedEvents = 0;
+        markDirty(fd);
+    }
+    int revents = cqe->res;
+    if (revents < 0) {
+        LOG_ERROR("IoUringPoller poll fd=%d error:%d", fd, -revents);
+        revents = EPOLLERR;
+    }
+    st.revents |= revents;
+    if (!st.active) {
+        st.active = true;
+        activeFds_.push_back(fd);
+    }
+}
+
+void IoUringPoller::updateChannel(Channel* channel) {
+    const int index = channel->index();
+    LOG_DEBUG("func=%s => fd=%d events=%d index=%d", __FUNCTION__,
+              channel->fd(), channel->events(), index);
+
+    if (index == kNew || index == kDeleted) {
+        if (index == kNew) {
+            addChannel(channel->fd(), channel);
+        }
+        channel->set_index(kAdded);
+    } else if (channel->isNoneEvent()) {
+        channel->set_index(kDeleted);
+    }
+    markDirty(channel->fd());
+    // 和EPollPoller一样：停止读又恢复读时重新提交poll，提交时内核会检查一次就绪状态，
+    // 否则multishot poll只在有新数据到达时才通知，暂停期间留下的数据就没人读了
+    FdState& st = states_[channel->fd()];
+    if (channel->isEdgeTriggered() && st.armedEvents != 0 &&
+        (static_cast<uint32_t>(channel->events()) & ~EPOLLET) !=
+            st.armedEvents) {
+        st.rearm = true;
+    }
+}
+
+void IoUringPoller::removeChannel(Channel* channel) {
+    int fd = channel->fd();
+    eraseChannel(fd);
+
+    LOG_INFO("func=%s => fd=%d\n", __FUNCTION__, fd);
+
+    // 准备撤销请求，gen加一之后旧请求的完成事件都会被丢弃，fd被复用也不会混淆
+    // 撤销马上提交：poll请求持有文件的引用，调用者接着close(fd)时内核要已经放掉它
+    syncFd(fd);
+    if (sqeTail_ != loadAcquire(sqHead_)) {
+        enter(0, 0);
+    }
+    channel->set_index(kNew);
+}
+
+void IoUringPoller::markDirty(int fd) {
+    FdState& st = state(fd);
+    if (!st.dirty) {
+        st.dirty = true;
+        dirtyFds_.push_back(fd);
+    }
+}
+
+void IoUringPoller::syncFd(int fd) {
+    FdState& st = state(fd);
+    Channel* channel = static_cast<size_t>(fd) < channels_.size()
+                           ? channels_[fd]
+                           : nullptr;
+    uint32_t wanted = 0;
+    bool     multishot = false;
+    if (channel != nullptr && channel->index() == kAdded &&
+        !channel->isNoneEvent()) {
+        wanted = static_cast<uint32_t>(channel->events()) & ~EPOLLET;
+        multishot = channel->isEdgeTriggered();
+    }
+    const bool rearm = st.rearm;
+    st.rearm = false;
+    if (!rearm && st.armedEvents == wanted && st.multishot == multishot) {
+        return;
+    }
+    if (st.armedEvents != 0) {
+        prepPollRemove(makeUserData(fd, st.gen));
+        st.armedEvents = 0;
+    }
+    ++st.gen;
+    if (wanted != 0) {
+        prepPollAdd(fd, wanted, multishot, makeUserData(fd, st.gen));
+        st.armedEvents = wanted;
+        st.multishot = multishot;
+    }
+}
+
+io_uring_sqe* IoUringPoller::getSqe() {
+    if (sqeTail_ - loadAcquire(sqHead_) >= sqEntries_) {
+        // 提交队列满了，先提交已经准备好的请求
+        enter(0, 0);
+    }
+    unsigned      index = sqeTail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++sqeTail_;
+    return sqe;
+}
+
+void IoUringPoller::prepPollAdd(int fd, uint32_t events, bool multishot,
+                                uint64_t userData) {
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = userData;
+}
+
+void IoUringPoller::prepPollRemove(uint64_t userData) {
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = kIgnoredUserData;
+}
+
+int IoUringPoller::enter(unsigned minComplete, int timeoutMs) {
+    storeRelease(sqTail_, sqeTail_);
+    // 上次提交失败留下的请求也一起提交
+    unsigned toSubmit = sqeTail_ - loadAcquire(sqHead_);
+
+    unsigned                      flags = 0;
+    __kernel_timespec             ts;
+    io_uring_getevents_arg        arg;
+    const io_uring_getevents_arg* argp = nullptr;
+    if (minComplete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeoutMs > 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+            ::memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            argp = &arg;
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+    int ret = ioUringEnter(ringFd_, toSubmit, minComplete, flags, argp,
+                           argp != nullptr ? sizeof(arg) : 0);
+    if (ret < 0) {
+        ret = -errno;
+        if (ret != -EINTR && ret != -ETIME) {
+            LOG_ERROR("io_uring_enter error:%d", -ret);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,29 @@
+#include "MemoryBudget.h"
+
+MemoryBudget::MemoryBudget(size_t limit, size_t connectionLimit,
+                           Policy policy)
+    : limit_(limit),
+      connectionLimit_(connectionLimit),
+      policy_(policy),
+      usage_(0),
+      peak_(0),
+      pausedReads_(0),
+      rejectedSends_(0),
+      rejectedBytes_(0),
+      forcedCloses_(0) {}
+
+void MemoryBudget::charge(int64_t delta) {
+    int64_t usage = usage_ += delta;
+    // 多个loop同时更新峰值，CAS直到写入的值不小于自己看到的usage
+    int64_t peak = peak_;
+    while (usage > peak && !peak_.compare_exchange_weak(peak, usage)) {
+    }
+}
+
+bool MemoryBudget::exceeds(size_t bytes, size_t connectionBytes) const {
+    if (connectionLimit_ > 0 && connectionBytes + bytes > connectionLimit_) {
+        return true;
+    }
+    return limit_ > 0 &&
+           usage_ + static_cast<int64_t>(bytes) > static_cast<int64_t>(limit_);
+}
@@ -1,10 +1,11 @@
 #include "Poller.h"
 #include "Channel.h"
 
-Poller::Poller(EventLoop* loop) : ownerLoop_(loop) {}
+Poller::Poller(EventLoop* loop) : numChannels_(0), ownerLoop_(loop) {}
 
 // 判断参数channel是否在当前Poller中
 bool Poller::hasChannel(Channel* channel) const {
-    auto it = channels_.find(channel->fd());
-    return it != channels_.end() && it->second == channel;
+    const int fd = channel->fd();
+    return fd >= 0 && static_cast<size_t>(fd) < channels_.size() &&
+           channels_[fd] == channel;
 }
\ No newline at end of file
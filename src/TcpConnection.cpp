@@ -1,9 +1,18 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include <functional>
+#include <iterator>
 #include <string>
 
 #include "Channel.h"
@@ -12,6 +21,12 @@
 #include "Socket.h"
 #include "TcpConnection.h"
 
+// 超出预算暂停读之后，每隔这么久检查一次能否恢复
+static const double kBudgetRetrySeconds = 0.1;
+// 连接销毁后等待零拷贝完成通知：每隔0.1秒读一次错误队列，最多等30秒
+static const double kZeroCopyLingerSeconds = 0.1;
+static const int    kZeroCopyLingerRetries = 300;
+
 // 确保loop不为空
 static EventLoop* CheckLoopNotNull(EventLoop* loop) {
     if (loop == nullptr) {
@@ -24,15 +39,52 @@ static EventLoop* CheckLoopNotNull(EventLoop* loop) {
 TcpConnection::TcpConnection(EventLoop* loop, const std::string& nameArg,
                              int sockfd, const InetAddress& localAddr,
                              const InetAddress& peerAddr)
+    : TcpConnection(loop, 0, std::shared_ptr<const std::string>(), sockfd,
+                    localAddr, peerAddr) {
+    std::call_once(nameOnce_, [&]() { name_ = nameArg; });
+}
+
+TcpConnection::TcpConnection(
+    EventLoop* loop, uint64_t id,
+    const std::shared_ptr<const std::string>& namePrefix, int sockfd,
+    const InetAddress& localAddr, const InetAddress& peerAddr)
     : loop_(CheckLoopNotNull(loop)),
-      name_(nameArg),
+      id_(id),
+      namePrefix_(namePrefix),
       state_(kConnecting),
       reading_(true),
       socket_(new Socket(sockfd)),
       channel_(new Channel(loop, sockfd)),
       localAddr_(localAddr),
       peerAddr_(peerAddr),
-      highWaterMark_(64 * 1024 * 1024)  // 64M
+      highWaterMark_(64 * 1024 * 1024),  // 64M
+      inputHighWaterMark_(0),
+      inputLowWaterMark_(0),
+      inputPaused_(false),
+      // 缓冲区存储都从所属loop的内存池中申请，有数据到达时才申请
+      inputBuffer_(0, loop->blockPool()),
+      // 积压数据较多时追加不搬移已有数据
+      outputBuffer_(Buffer::kSegmented, Buffer::kBlockSize,
+                    loop->blockPool()),
+      edgeTriggered_(false),
+      eventByteBudget_(kEventByteBudget),
+      writeWaiting_(false),
+      coalescing_(false),
+      flushScheduled_(false),
+      stagedCount_(0),
+      stagedBatches_(0),
+      outputRetrieved_(0),
+      zeroCopyThreshold_(0),
+      zeroCopyNextSeq_(0),
+      idleTimeout_(0),
+      idleEntry_(std::bind(&TcpConnection::handleIdleTimeout, this)),
+      chargedBytes_(0),
+      budgetPaused_(false),
+      bufferReleaseDelay_(0),
+      bufferReleaseEntry_(
+          std::bind(&TcpConnection::releaseIdleBuffersInLoop, this)),
+      buffersIdle_(false),
+      idleHeldBytes_(0)
 {
     // 下面给channel设置相应的回调函数 poller给channel通知感兴趣的事件发生了
     // channel会回调相应的回调函数
@@ -45,18 +97,78 @@ TcpConnection::TcpConnection(EventLoop* loop, const std::string& nameArg,
     channel_->setErrorCallback(
         std::bind(&TcpConnection::handleError, this));
 
-    LOG_INFO("TcpConnection::ctor[%s] at fd=%d", name_.c_str(), sockfd);
+    LOG_INFO("TcpConnection::ctor[#%lu] at fd=%d", id_ >> 32, sockfd);
     socket_->setKeepAlive(true);
 }
 
 TcpConnection::~TcpConnection() {
-    LOG_INFO("TcpConnection::dtor[%s] at fd=%d state=%d", name_.c_str(),
+    LOG_INFO("TcpConnection::dtor[#%lu] at fd=%d state=%d", id_ >> 32,
              channel_->fd(), (int)state_);
+    // 没发送完的文件段
+    for (const FileSegment& seg : pendingFiles_) {
+        ::close(seg.fd);
+    }
+    // 内核在通知完成之前一直在读这些内存，还给内存池被复用就会发出被改写的数据，
+    // 正常情况下connectDestroyed会等到通知全部到达，这里只处理等不到的情况
+    if (!zeroCopyPins_.empty()) {
+        abandonZeroCopyPins();
+    }
 }
 
-// 发送c类型的字符串
+const std::string& TcpConnection::name() const {
+    std::call_once(nameOnce_, [this]() {
+        name_ = *namePrefix_ + "#" + std::to_string(id_ >> 32);
+    });
+    return name_;
+}
+
+// 发送c类型的字符串，在loop线程中直接发送，不构造临时string
 void TcpConnection::send(const void* msg, int len) {
-    send(std::string((const char*)msg, len));
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendInLoop(msg, len);
+        } else {
+            // 只拷贝一次，之后一直按引用传递
+            send(SharedPayload::create(msg, len));
+        }
+    }
+}
+
+// 多段数据一次writev发出，只有没发完的部分才会拷贝进outputBuffer_
+void TcpConnection::send(const Slice* slices, size_t count) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendInLoop(slices, count);
+        } else {
+            // 跨线程时slices指向的内存可能失效，只能拼起来拷贝一份
+            std::string message;
+            for (size_t i = 0; i < count; ++i) {
+                message.append(static_cast<const char*>(slices[i].data),
+                               slices[i].len);
+            }
+            send(std::move(message));
+        }
+    }
+}
+
+void TcpConnection::send(std::initializer_list<Slice> slices) {
+    send(slices.begin(), slices.size());
+}
+
+void TcpConnection::send(const SharedPayloadPtr& payload) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            sendSharedInLoop(payload);
+        } else {
+            // 只拷贝智能指针，不拷贝数据
+            StagedSend* item = new StagedSend;
+            item->slice.data = payload->data();
+            item->slice.len = payload->size();
+            item->ref = payload;
+            item->shared = true;
+            stageSend(item);
+        }
+    }
 }
 
 // 发送string类型
@@ -67,24 +179,47 @@ void TcpConnection::send(const std::string& msg) {
         if (loop_->isInLoopThread()) {
             sendInLoop(msg);
         } else {
-            // 函数指针fp指向sendInLoop函数
-            void (TcpConnection::*fp)(const std::string& msg) =
-                &TcpConnection::sendInLoop;
-            loop_->runInLoop(std::bind(fp, this, msg));
+            send(SharedPayload::create(msg.data(), msg.size()));
+        }
+    }
+}
+
+void TcpConnection::send(std::string&& message) {
+    if (state_ == kConnected) {
+        // 小消息直接发送，没发完的尾部拷贝的代价比包装成引用还低
+        if (loop_->isInLoopThread() && message.size() < Buffer::kBlockSize) {
+            sendInLoop(message);
+        } else {
+            // string的内存直接移动进payload
+            send(SharedPayload::create(std::move(message)));
         }
     }
 }
 
 void TcpConnection::send(Buffer* buf) {
     if (state_ == kConnected) {
-        if (loop_->isInLoopThread()) {
+        // 分段模式的buf调用peek()会把所有块合并拷贝一次，直接按块交出去
+        if (loop_->isInLoopThread() && !buf->segmented()) {
             sendInLoop(buf->peek(), buf->readableBytes());
             buf->retrieveAll();
         } else {
-            void (TcpConnection::*fp)(const std::string& message) =
-                &TcpConnection::sendInLoop;
-            loop_->runInLoop(
-                std::bind(fp, this, buf->retrieveAllAsString()));
+            send(std::move(*buf));
+        }
+    }
+}
+
+void TcpConnection::send(Buffer&& buf) {
+    if (state_ == kConnected) {
+        // 存储整块交给引用，buf变为空
+        std::unique_ptr<StagedSend> item(new StagedSend);
+        buf.detach(&item->slices, &item->refs);
+        if (item->slices.empty()) {
+            return;
+        }
+        if (loop_->isInLoopThread()) {
+            sendRefsInLoop(item->slices, item->refs);
+        } else {
+            stageSend(item.release());
         }
     }
 }
@@ -96,6 +231,80 @@ void TcpConnection::sendInLoop(const std::string& msg) {
 }
 
 void TcpConnection::sendInLoop(const void* data, size_t len) {
+    Slice slice = {data, len};
+    sendInLoop(&slice, 1);
+}
+
+void TcpConnection::sendInLoop(const Slice* slices, size_t count) {
+    sendInLoop(slices, count, nullptr);
+}
+
+void TcpConnection::sendSharedInLoop(const SharedPayloadPtr& payload) {
+    Slice            slice = {payload->data(), payload->size()};
+    Buffer::BlockRef ref = payload;
+    const char       shared = 1;
+    sendInLoop(&slice, 1, &ref, &shared);
+}
+
+void TcpConnection::sendRefsInLoop(const std::vector<Slice>&            slices,
+                                   const std::vector<Buffer::BlockRef>& refs) {
+    sendInLoop(slices.data(), slices.size(), refs.data());
+}
+
+void TcpConnection::stageSend(StagedSend* item) {
+    // 链表原来不空说明drain任务已经排上还没执行，数据会被它一起发出去，
+    // 这样一批跨线程发送只排一次任务、写一次eventfd
+    if (stagedSends_.push(item)) {
+        loop_->queueInLoop(std::bind(&TcpConnection::drainStagedInLoop,
+                                     shared_from_this()));
+    }
+}
+
+void TcpConnection::drainStagedInLoop() {
+    // 一次取走整条链表，之后入队的生产者看到空链表会再排一次任务，不会漏发
+    StagedSend*                   item = stagedSends_.popAll();
+    std::vector<Slice>            slices;
+    std::vector<Buffer::BlockRef> refs;
+    std::vector<char>             shared;
+    uint64_t                      count = 0;
+    while (item) {
+        std::unique_ptr<StagedSend> done(item);
+        item = item->next;
+        ++count;
+        if (done->slices.empty()) {
+            slices.push_back(done->slice);
+            refs.push_back(std::move(done->ref));
+            shared.push_back(done->shared);
+            continue;
+        }
+        slices.insert(slices.end(), done->slices.begin(), done->slices.end());
+        refs.insert(refs.end(), std::make_move_iterator(done->refs.begin()),
+                    std::make_move_iterator(done->refs.end()));
+        shared.insert(shared.end(), done->slices.size(), done->shared);
+    }
+    // 只在loop线程中修改
+    stagedCount_.store(stagedCount_.load(std::memory_order_relaxed) + count,
+                       std::memory_order_relaxed);
+    stagedBatches_.store(stagedBatches_.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    if (!slices.empty()) {
+        // 一次writev发出，剩下的按引用排进outputBuffer_
+        sendInLoop(slices.data(), slices.size(), refs.data(), shared.data());
+    }
+}
+
+void TcpConnection::sendInLoop(const Slice* slices, size_t count,
+                               const Buffer::BlockRef* refs,
+                               const char* shared) {
+    size_t len = 0;
+    size_t ownedLen = 0;  // 排队时计入这个连接预算的部分
+    for (size_t i = 0; i < count; ++i) {
+        len += slices[i].len;
+        if (!shared || !shared[i]) {
+            ownedLen += slices[i].len;
+        }
+    }
+
     ssize_t nwrote = 0;
     size_t  remaining = len;
     bool    faultError = false;
@@ -105,11 +314,61 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
         LOG_ERROR("disconnected, give up writing");
     }
 
+    // 前面还有排队的数据，这次要整个放进outputBuffer_，超出预算就拒绝
+    if (memoryBudget_ &&
+        memoryBudget_->policy() == MemoryBudget::kRejectSend &&
+        (waitingWritable() || hasQueuedOutput()) &&
+        memoryBudget_->exceeds(ownedLen, chargedBytes_)) {
+        memoryBudget_->countRejectedSend(len);
+        LOG_DEBUG("TcpConnection::sendInLoop [%s] over memory budget, "
+                  "reject %lu bytes",
+                  name().c_str(), len);
+        if (sendRejectedCallback_) {
+            loop_->queueInLoop(
+                std::bind(sendRejectedCallback_, shared_from_this(), len));
+        }
+        return;
+    }
+
     // 表示channel_第一次开始写数据或者缓冲区没有待发送数据
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
-        nwrote = ::write(channel_->fd(), data, len);
+    // 合并写模式下先全部放进outputBuffer_，本轮末尾再一起发送
+    if (!coalescing_ && !waitingWritable() && !hasQueuedOutput()) {
+        // 多段数据组织成iovec一次发出，超过IOV_MAX的部分进缓冲区
+        struct iovec vec[IOV_MAX];
+        int          iovcnt =
+            static_cast<int>(std::min(count, static_cast<size_t>(IOV_MAX)));
+        for (int i = 0; i < iovcnt; ++i) {
+            vec[i].iov_base = const_cast<void*>(slices[i].data);
+            vec[i].iov_len = slices[i].len;
+        }
+        // 只有按引用传进来的数据生命周期由连接掌握，可以等到内核通知完成再释放
+        const bool zeroCopy = refs != nullptr && zeroCopyThreshold_ > 0 &&
+                              len >= zeroCopyThreshold_;
+        if (zeroCopy) {
+            struct msghdr msg;
+            ::memset(&msg, 0, sizeof msg);
+            msg.msg_iov = vec;
+            msg.msg_iovlen = iovcnt;
+            nwrote = ::sendmsg(channel_->fd(), &msg, MSG_ZEROCOPY);
+            if (nwrote > 0) {
+                std::vector<Buffer::BlockRef> pinned(refs, refs + iovcnt);
+                pinZeroCopy(&pinned);
+            }
+        }
+        // 超过optmem限制时内核返回ENOBUFS，这一次退化为普通发送
+        if (zeroCopy && nwrote < 0 && errno == ENOBUFS) {
+            ++zeroCopyCounters_->fallbacks;
+        }
+        if (!zeroCopy || (nwrote < 0 && errno == ENOBUFS)) {
+            nwrote = iovcnt == 1 ? ::write(channel_->fd(), vec[0].iov_base,
+                                           vec[0].iov_len)
+                                 : ::writev(channel_->fd(), vec, iovcnt);
+        }
         if (nwrote >= 0) {
             remaining = len - nwrote;
+            if (nwrote > 0) {
+                refreshIdleTimer();
+            }
             if (remaining == 0 && writeCompleteCallback_) {
                 // 既然在这里数据全部发送完成，就不用再给channel设置epollout事件了
                 loop_->queueInLoop(
@@ -145,13 +404,211 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
                                          shared_from_this(),
                                          oldLen + remaining));
         }
-        outputBuffer_.append((char*)data + nwrote, remaining);
-        if (!channel_->isWriting()) {
-            channel_
-                ->enableWriting();  // 这里一定要注册channel的写事件
-                                    // 否则poller不会给channel通知epollout
+        markBuffersActive();
+        // 跳过已经发出去的nwrote字节，只排队没发完的部分
+        // 有引用的数据只挂引用，不拷贝
+        size_t skip = nwrote;
+        bool   sharedCharged = false;
+        for (size_t i = 0; i < count; ++i) {
+            if (skip >= slices[i].len) {
+                skip -= slices[i].len;
+                continue;
+            }
+            const char* data = static_cast<const char*>(slices[i].data) + skip;
+            if (shared && shared[i]) {
+                SharedPayloadPtr payload =
+                    std::static_pointer_cast<const SharedPayload>(refs[i]);
+                outputBuffer_.appendShared(payload,
+                                           data - payload->data());
+                if (memoryBudget_ && payload->chargeTo(memoryBudget_)) {
+                    sharedCharged = true;
+                }
+            } else if (refs) {
+                outputBuffer_.appendRef(refs[i], data, slices[i].len - skip);
+            } else {
+                outputBuffer_.append(data, slices[i].len - skip);
+            }
+            skip = 0;
+        }
+        if (coalescing_) {
+            if (!waitingWritable()) {
+                scheduleFlush();
+            }
+        } else {
+            waitWritable();  // 这里一定要注册channel的写事件
+                             // 否则poller不会给channel通知epollout
+        }
+        updateMemoryCharge(sharedCharged);
+    }
+}
+
+void TcpConnection::flush() {
+    if (loop_->isInLoopThread()) {
+        flushInLoop();
+    } else {
+        loop_->runInLoop(
+            std::bind(&TcpConnection::flushInLoop, shared_from_this()));
+    }
+}
+
+void TcpConnection::scheduleFlush() {
+    if (!flushScheduled_) {
+        flushScheduled_ = true;
+        loop_->runAtIterationEnd(
+            std::bind(&TcpConnection::flushInLoop, shared_from_this()));
+    }
+}
+
+// 把outputBuffer_中暂存的数据尽量发出去，发不完再注册EPOLLOUT
+void TcpConnection::flushInLoop() {
+    flushScheduled_ = false;
+    if (state_ == kDisconnected || waitingWritable() || !hasQueuedOutput()) {
+        return;
+    }
+    int     savedErrno = 0;
+    ssize_t n = 0;
+    ssize_t total = 0;
+    while (hasQueuedOutput() && (n = writeQueued(&savedErrno)) > 0) {
+        total += n;
+    }
+    if (total > 0) {
+        refreshIdleTimer();
+    }
+    updateMemoryCharge();
+    if (n < 0 && savedErrno != EWOULDBLOCK) {
+        errno = savedErrno;
+        LOG_ERROR("TcpConnection::flushInLoop");
+        if (savedErrno == EPIPE || savedErrno == ECONNRESET) {
+            return;  // 等读到0或者EPOLLHUP时关闭连接
+        }
+    }
+    if (hasQueuedOutput()) {
+        waitWritable();
+    } else {
+        handleOutputDrained();
+    }
+}
+
+void TcpConnection::sendFile(int fd, off_t offset, size_t length) {
+    if (state_ == kConnected) {
+        // dup一份由连接自己持有，发送完或者连接析构时关闭
+        int filefd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (filefd < 0) {
+            LOG_ERROR("TcpConnection::sendFile dup fd=%d error:%d", fd, errno);
+            return;
+        }
+        if (loop_->isInLoopThread()) {
+            sendFileInLoop(filefd, offset, length);
+        } else {
+            loop_->runInLoop(std::bind(&TcpConnection::sendFileInLoop,
+                                       shared_from_this(), filefd, offset,
+                                       length));
+        }
+    }
+}
+
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t length) {
+    bool faultError = false;
+
+    if (state_ == kDisconnected) {
+        LOG_ERROR("disconnected, give up sending file");
+        ::close(fd);
+        return;
+    }
+
+    // 前面没有排队的数据，直接尝试sendfile一次
+    if (!waitingWritable() && !hasQueuedOutput()) {
+        ssize_t n = ::sendfile(channel_->fd(), fd, &offset, length);
+        if (n >= 0) {
+            length -= n;
+            if (length == 0 && writeCompleteCallback_) {
+                loop_->queueInLoop(
+                    std::bind(writeCompleteCallback_, shared_from_this()));
+            }
+        } else if (errno != EWOULDBLOCK) {
+            LOG_ERROR("TcpConnection::sendFileInLoop");
+            if (errno == EPIPE || errno == ECONNRESET) {
+                faultError = true;
+            }
         }
     }
+
+    if (faultError || length == 0) {
+        ::close(fd);
+        return;
+    }
+
+    // 剩下的部分排在outputBuffer_当前所有数据之后，等EPOLLOUT再发送
+    FileSegment seg;
+    seg.fd = fd;
+    seg.offset = offset;
+    seg.remaining = length;
+    seg.bufferPos = outputRetrieved_ + outputBuffer_.readableBytes();
+    pendingFiles_.push_back(seg);
+    waitWritable();
+}
+
+// 先发送排在头部文件段之前的outputBuffer_数据，再sendfile头部文件段
+ssize_t TcpConnection::writeQueued(int* savedErrno) {
+    // 提前结束的文件段丢弃之后接着发后面排队的数据，
+    // 返回0只表示没有任何数据可发，调用者据此停止
+    while (hasQueuedOutput()) {
+        size_t bufferBytes = outputBuffer_.readableBytes();
+        if (!pendingFiles_.empty()) {
+            bufferBytes = pendingFiles_.front().bufferPos - outputRetrieved_;
+        }
+
+        if (bufferBytes > 0) {
+            ssize_t    n = -1;
+            const bool zeroCopy =
+                zeroCopyThreshold_ > 0 && bufferBytes >= zeroCopyThreshold_;
+            if (zeroCopy) {
+                n = outputBuffer_.writeFd(channel_->fd(), savedErrno,
+                                          bufferBytes, MSG_ZEROCOPY);
+                if (n > 0) {
+                    // 发出去的块在retrieve之后仍然由pin持有，不会被复用
+                    std::vector<Buffer::BlockRef> refs;
+                    outputBuffer_.pin(n, &refs);
+                    pinZeroCopy(&refs);
+                }
+            }
+            if (zeroCopy && n < 0 && *savedErrno == ENOBUFS) {
+                ++zeroCopyCounters_->fallbacks;
+            }
+            if (!zeroCopy || (n < 0 && *savedErrno == ENOBUFS)) {
+                n = outputBuffer_.writeFd(channel_->fd(), savedErrno,
+                                          bufferBytes);
+            }
+            if (n > 0) {
+                outputBuffer_.retrieve(n);
+                outputRetrieved_ += n;
+            }
+            return n;
+        }
+
+        FileSegment& seg = pendingFiles_.front();
+        ssize_t      n =
+            ::sendfile(channel_->fd(), seg.fd, &seg.offset, seg.remaining);
+        if (n < 0) {
+            *savedErrno = errno;
+            return n;
+        }
+        if (n == 0 && seg.remaining > 0) {
+            // 文件比length短，没有更多数据可发了
+            LOG_ERROR("TcpConnection::writeQueued file fd=%d ended early with "
+                      "%lu bytes left",
+                      seg.fd, seg.remaining);
+        }
+        seg.remaining -= std::min(seg.remaining, static_cast<size_t>(n));
+        if (seg.remaining == 0 || n == 0) {
+            ::close(seg.fd);
+            pendingFiles_.pop_front();
+        }
+        if (n > 0) {
+            return n;
+        }
+    }
+    return 0;
 }
 
 void TcpConnection::shutdown() {
@@ -163,16 +620,72 @@ void TcpConnection::shutdown() {
 
 void TcpConnection::shutdownInLoop() {
     // 说明当前outputBuffer_的数据全部向外发送完成
-    if (!channel_->isWriting()) {
+    // 合并写暂存的数据还没有发送时，由flush发送完之后再关闭
+    if (!waitingWritable() && !hasQueuedOutput()) {
         socket_->shutdownWrite();
     }
 }
 
+void TcpConnection::startRead() {
+    loop_->runInLoop(
+        std::bind(&TcpConnection::startReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::startReadInLoop() {
+    reading_ = true;
+    updateReadInterest();
+}
+
+void TcpConnection::stopRead() {
+    loop_->runInLoop(
+        std::bind(&TcpConnection::stopReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::stopReadInLoop() {
+    reading_ = false;
+    updateReadInterest();
+}
+
+void TcpConnection::checkInputWaterMark() {
+    loop_->runInLoop(std::bind(&TcpConnection::checkInputWaterMarkInLoop,
+                               shared_from_this()));
+}
+
+void TcpConnection::checkInputWaterMarkInLoop() {
+    if (inputPaused_ &&
+        inputBuffer_.readableBytes() <= inputLowWaterMark_) {
+        inputPaused_ = false;
+        updateReadInterest();
+    }
+}
+
+void TcpConnection::updateReadInterest() {
+    // 连接断开后channel已经不再关注任何事件
+    if (state_ == kDisconnected || state_ == kConnecting) {
+        return;
+    }
+    const bool wantRead = reading_ && !budgetPaused_ && !inputPaused_;
+    if (wantRead && !channel_->isReading()) {
+        channel_->enableReading();
+    } else if (!wantRead && channel_->isReading()) {
+        channel_->disableReading();
+    }
+}
+
 // 连接建立
 void TcpConnection::connectEstablished() {
     setState(kConnected);
     channel_->tie(shared_from_this());
-    channel_->enableReading();  // 向poller注册channel的EPOLLIN读事件
+    if (edgeTriggered_) {
+        // 读写事件一次注册，之后只有停止/恢复读才会修改
+        channel_->setEdgeTriggered(true);
+        channel_->enableAll();
+    } else {
+        channel_->enableReading();  // 向poller注册channel的EPOLLIN读事件
+    }
+    if (idleTimeout_ > 0) {
+        loop_->timingWheel()->schedule(&idleEntry_, idleTimeout_);
+    }
 
     // 新连接建立 执行回调
     connectionCallback_(shared_from_this());
@@ -180,6 +693,18 @@ void TcpConnection::connectEstablished() {
 
 // 连接销毁
 void TcpConnection::connectDestroyed() {
+    if (idleEntry_.scheduled()) {
+        loop_->timingWheel()->cancel(&idleEntry_);
+    }
+    if (bufferReleaseEntry_.scheduled()) {
+        loop_->timingWheel()->cancel(&bufferReleaseEntry_);
+    }
+    markBuffersActive();  // 不再计入空闲字节数
+    if (memoryBudget_) {
+        // 剩下没发完的数据不再计入预算
+        memoryBudget_->charge(-static_cast<int64_t>(chargedBytes_.load()));
+        chargedBytes_ = 0;
+    }
     if (state_ == kConnected) {
         setState(kDisconnected);
         // 把channel的所有感兴趣的事件从poller中删除掉
@@ -187,50 +712,166 @@ void TcpConnection::connectDestroyed() {
         connectionCallback_(shared_from_this());
     }
     channel_->remove();  // 把channel从poller中删除掉
+    if (!zeroCopyPins_.empty()) {
+        // socket要等通知读完才能关闭，bind持有的引用让连接多活一会儿
+        lingerZeroCopyInLoop(kZeroCopyLingerRetries);
+    }
 }
 
 // 读是相对服务器而言的 当对端客户端有数据到达 服务器端检测到EPOLLIN
 // 就会触发该fd上的回调 handleRead取读走对端发来的数据
 void TcpConnection::handleRead(Timestamp receiveTime) {
-    int     savedErrno = 0;
-    ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
-    if (n > 0) {  // 有数据到达
-        // 已建立连接的用户有可读事件发生了 调用用户传入的回调操作onMessage
-        // shared_from_this就是获取了TcpConnection的智能指针
-        messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
-    } else if (n == 0) {  // 无消息，客户端断开
-        handleClose();
-    } else {  // 出错了
-        errno = savedErrno;
-        LOG_ERROR("TcpConnection::handleRead");
-        handleError();
+    markBuffersActive();
+    // 本轮的读取预算，边沿触发下和连接自己的字节预算取较小的一个
+    size_t maxBytes = loop_->readBudgetBytes();
+    if (edgeTriggered_ && eventByteBudget_ > 0 &&
+        (maxBytes == 0 || eventByteBudget_ < maxBytes)) {
+        maxBytes = eventByteBudget_;
+    }
+    const int maxReads = loop_->readBudgetReads();
+    size_t    total = 0;
+    int       reads = 0;
+    for (;;) {
+        int     savedErrno = 0;
+        ssize_t n =
+            maxBytes > 0
+                ? inputBuffer_.readFd(channel_->fd(), &savedErrno,
+                                      maxBytes - total)
+                : inputBuffer_.readFd(channel_->fd(), &savedErrno);
+        if (n > 0) {  // 有数据到达
+            refreshIdleTimer();
+            // 已建立连接的用户有可读事件发生了 调用用户传入的回调操作onMessage
+            // shared_from_this就是获取了TcpConnection的智能指针
+            messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+            if (inputHighWaterMark_ > 0 && !inputPaused_ &&
+                inputBuffer_.readableBytes() >= inputHighWaterMark_) {
+                // 应用处理不过来，不再从内核读入新的数据
+                inputPaused_ = true;
+                updateReadInterest();
+            }
+            updateMemoryCharge();
+            markBuffersIdle();
+
+            total += n;
+            ++reads;
+            const bool exhausted = (maxBytes > 0 && total >= maxBytes) ||
+                                   (maxReads > 0 && reads >= maxReads);
+            // 水平触发下没读完的数据epoll会再次通知
+            // 停止读之后重新注册EPOLLIN时，边沿触发也会再报告一次就绪
+            if (!edgeTriggered_ || !channel_->isReading()) {
+                if (maxBytes > 0 && total >= maxBytes) {
+                    loop_->countReadBudgetHit();
+                }
+                break;
+            }
+            if (exhausted) {
+                // 没有读到EAGAIN就不会再有边沿，自己排到下一轮继续读
+                loop_->countReadBudgetHit();
+                loop_->runNextIteration(std::bind(
+                    &TcpConnection::continueReadInLoop, shared_from_this()));
+                break;
+            }
+        } else if (n == 0) {  // 无消息，客户端断开
+            handleClose();
+            break;
+        } else {
+            if (edgeTriggered_ && savedErrno == EWOULDBLOCK) {
+                break;  // 读空了，等下一次边沿
+            }
+            // 出错了
+            errno = savedErrno;
+            LOG_ERROR("TcpConnection::handleRead");
+            handleError();
+            break;
+        }
     }
 }
 
 void TcpConnection::handleWrite() {
-    if (channel_->isWriting()) {
+    if (!waitingWritable()) {
+        // 边沿触发下EPOLLOUT一直注册着，没有排队数据时的通知直接忽略
+        if (!edgeTriggered_) {
+            LOG_ERROR("TcpConnection fd=%d is down, no more writing",
+                      channel_->fd());
+        }
+        return;
+    }
+    size_t total = 0;
+    for (;;) {
         int     savedErrno = 0;
-        ssize_t n = outputBuffer_.writeFd(channel_->fd(), &savedErrno);
+        ssize_t n = writeQueued(&savedErrno);
         if (n > 0) {
-            outputBuffer_.retrieve(n);
-            if (outputBuffer_.readableBytes() == 0) {
-                channel_->disableWriting();
-                if (writeCompleteCallback_) {
-                    // TcpConnection对象在其所在的subloop中
-                    // 向pendingFunctors_中加入回调
-                    loop_->queueInLoop(std::bind(writeCompleteCallback_,
-                                                 shared_from_this()));
-                }
-                if (state_ == kDisconnecting) {
-                    shutdownInLoop();  // 在当前所属的loop中把TcpConnection删除掉
-                }
+            refreshIdleTimer();
+            updateMemoryCharge();
+        }
+        if (n < 0) {
+            if (!edgeTriggered_ || savedErrno != EWOULDBLOCK) {
+                errno = savedErrno;
+                LOG_ERROR("TcpConnection::handleWrite");
             }
-        } else {
-            LOG_ERROR("TcpConnection::handleWrite");
+            break;
         }
+        if (!hasQueuedOutput()) {
+            // outputBuffer_和文件段都发送完了
+            cancelWaitWritable();
+            handleOutputDrained();
+            break;
+        }
+        if (!edgeTriggered_ || n == 0) {
+            break;
+        }
+        total += n;
+        if (total >= eventByteBudget_) {
+            // 没有遇到EAGAIN就不会再有边沿，需要自己排到下一轮继续写
+            loop_->runNextIteration(std::bind(
+                &TcpConnection::continueWriteInLoop, shared_from_this()));
+            break;
+        }
+    }
+}
+
+bool TcpConnection::waitingWritable() const {
+    return edgeTriggered_ ? writeWaiting_ : channel_->isWriting();
+}
+
+void TcpConnection::waitWritable() {
+    if (edgeTriggered_) {
+        writeWaiting_ = true;
+    } else if (!channel_->isWriting()) {
+        channel_->enableWriting();
+    }
+}
+
+void TcpConnection::cancelWaitWritable() {
+    if (edgeTriggered_) {
+        writeWaiting_ = false;
     } else {
-        LOG_ERROR("TcpConnection fd=%d is down, no more writing",
-                  channel_->fd());
+        channel_->disableWriting();
+    }
+}
+
+void TcpConnection::continueReadInLoop() {
+    if (state_ != kDisconnected && channel_->isReading()) {
+        handleRead(Timestamp::now());
+    }
+}
+
+void TcpConnection::continueWriteInLoop() {
+    if (state_ != kDisconnected && writeWaiting_) {
+        handleWrite();
+    }
+}
+
+void TcpConnection::handleOutputDrained() {
+    markBuffersIdle();
+    if (writeCompleteCallback_) {
+        // TcpConnection对象在其所在的subloop中
+        // 向pendingFunctors_中加入回调
+        loop_->queueInLoop(
+            std::bind(writeCompleteCallback_, shared_from_this()));
+    }
+    if (state_ == kDisconnecting) {
+        shutdownInLoop();  // 在当前所属的loop中把TcpConnection删除掉
     }
 }
 
@@ -248,6 +889,9 @@ void TcpConnection::handleClose() {
 }
 
 void TcpConnection::handleError() {
+    // 零拷贝的完成通知也是通过EPOLLERR上报的，必须读完，否则会一直触发
+    bool completions = zeroCopyCounters_ && handleZeroCopyCompletions();
+
     int       optval;
     socklen_t optlen = sizeof optval;
     int       err = 0;
@@ -257,8 +901,299 @@ void TcpConnection::handleError() {
     } else {
         err = optval;
     }
+    if (completions && err == 0) {
+        return;
+    }
     LOG_ERROR("TcpConnection::handleError name:%s - SO_ERROR:%d",
-              name_.c_str(), err);
+              name().c_str(), err);
+}
+
+void TcpConnection::setZeroCopy(size_t                     threshold,
+                                const ZeroCopyCountersPtr& counters) {
+    if (threshold > 0 && !socket_->setZeroCopy(true)) {
+        LOG_ERROR("TcpConnection::setZeroCopy [%s] SO_ZEROCOPY error:%d",
+                  name().c_str(), errno);
+        threshold = 0;
+    }
+    zeroCopyThreshold_ = threshold;
+    if (threshold > 0) {
+        if (counters) {
+            zeroCopyCounters_ = counters;
+        } else if (!zeroCopyCounters_) {
+            zeroCopyCounters_ = std::make_shared<ZeroCopyCounters>();
+        }
+    }
+}
+
+// 每一次成功的MSG_ZEROCOPY发送，内核都按顺序分配一个序号
+void TcpConnection::pinZeroCopy(std::vector<Buffer::BlockRef>* refs) {
+    ZeroCopyPin pin;
+    pin.seq = zeroCopyNextSeq_++;
+    pin.done = false;
+    pin.refs.swap(*refs);
+    zeroCopyPins_.push_back(std::move(pin));
+    ++zeroCopyCounters_->sends;
+}
+
+bool TcpConnection::handleZeroCopyCompletions() {
+    bool any = false;
+    for (;;) {
+        char          control[128];
+        struct msghdr msg;
+        ::memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        // 错误队列为空时返回EAGAIN
+        if (::recvmsg(channel_->fd(), &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 &&
+                  cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            const struct sock_extended_err* serr =
+                reinterpret_cast<const struct sock_extended_err*>(
+                    CMSG_DATA(cm));
+            if (serr->ee_errno != 0 ||
+                serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // [ee_info, ee_data]这一段序号的发送都已完成
+            completeZeroCopy(serr->ee_info, serr->ee_data,
+                             serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            any = true;
+        }
+    }
+    return any;
+}
+
+void TcpConnection::completeZeroCopy(uint32_t lo, uint32_t hi, bool copied) {
+    const uint32_t count = hi - lo + 1;
+    if (copied) {
+        zeroCopyCounters_->copied += count;
+    } else {
+        zeroCopyCounters_->hits += count;
+    }
+    // 通知一般是按顺序的，这里也允许乱序，只有头部连续完成的才出队
+    for (ZeroCopyPin& pin : zeroCopyPins_) {
+        if (pin.seq - lo <= hi - lo) {
+            pin.done = true;
+            pin.refs.clear();
+        }
+    }
+    while (!zeroCopyPins_.empty() && zeroCopyPins_.front().done) {
+        zeroCopyPins_.pop_front();
+    }
+    if (copied && zeroCopyThreshold_ > 0) {
+        // 内核还是做了拷贝（例如回环地址或者网卡不支持分散聚合），
+        // 继续零拷贝只会多出等待通知的开销，之后都走普通发送
+        LOG_INFO("TcpConnection::completeZeroCopy [%s] kernel copied, "
+                 "zero copy disabled",
+                 name().c_str());
+        zeroCopyThreshold_ = 0;
+    }
+}
+
+// channel已经从poller中删除，收不到EPOLLERR，只能定时读错误队列
+// 对端关闭或者数据被确认之后内核释放skb，通知很快就会到达
+void TcpConnection::lingerZeroCopyInLoop(int retriesLeft) {
+    handleZeroCopyCompletions();
+    if (zeroCopyPins_.empty()) {
+        return;
+    }
+    if (retriesLeft <= 0) {
+        abandonZeroCopyPins();
+        return;
+    }
+    loop_->runAfter(kZeroCopyLingerSeconds,
+                    std::bind(&TcpConnection::lingerZeroCopyInLoop,
+                              shared_from_this(), retriesLeft - 1));
+}
+
+// 还没有通知完成的内存故意泄漏：宁可丢掉这些块，也不能让内核发出被改写的数据
+void TcpConnection::abandonZeroCopyPins() {
+    size_t blocks = 0;
+    for (const ZeroCopyPin& pin : zeroCopyPins_) {
+        blocks += pin.refs.size();
+    }
+    LOG_ERROR("TcpConnection [%s] abandons %lu zero copy blocks without "
+              "completion",
+              name().c_str(), blocks);
+    std::deque<ZeroCopyPin>* leaked = new std::deque<ZeroCopyPin>();
+    leaked->swap(zeroCopyPins_);
+}
+
+void TcpConnection::setIdleTimeout(double seconds) {
+    idleTimeout_ = seconds;
+    if (state_ != kConnected) {
+        // 还没有建立连接时由connectEstablished开始计时
+        return;
+    }
+    if (seconds > 0) {
+        loop_->timingWheel()->schedule(&idleEntry_, seconds);
+    } else if (idleEntry_.scheduled()) {
+        loop_->timingWheel()->cancel(&idleEntry_);
+    }
+}
+
+void TcpConnection::refreshIdleTimer() {
+    if (idleTimeout_ > 0) {
+        loop_->timingWheel()->refresh(&idleEntry_);
+    }
+}
+
+void TcpConnection::handleIdleTimeout() {
+    LOG_INFO("TcpConnection [%s] idle for %.1f seconds, force close",
+             name().c_str(), idleTimeout_);
+    forceClose();
+}
+
+// 缓冲区中排队的字节数发生变化后，把差值计入预算，并检查是否超出
+// sharedCharged表示刚刚在总预算中计入了新排队的SharedPayload
+void TcpConnection::updateMemoryCharge(bool sharedCharged) {
+    if (!memoryBudget_ || state_ == kDisconnected) {
+        return;
+    }
+    // 排队的SharedPayload在总预算中只计一次，广播给很多连接时不会按连接数放大
+    const size_t  bytes = inputBuffer_.readableBytes() +
+                         outputBuffer_.ownedBytes();
+    const int64_t delta = static_cast<int64_t>(bytes) -
+                          static_cast<int64_t>(chargedBytes_.load());
+    if (delta != 0) {
+        chargedBytes_ = bytes;
+        memoryBudget_->charge(delta);
+    }
+
+    if (budgetPaused_) {
+        if (!overBudget()) {
+            budgetPaused_ = false;
+            updateReadInterest();
+        }
+        return;
+    }
+    if ((delta <= 0 && !sharedCharged) || !overBudget()) {
+        return;
+    }
+    switch (memoryBudget_->policy()) {
+    case MemoryBudget::kStopReading:
+        // 停止读对端的数据，不再产生新的输入和回复
+        budgetPaused_ = true;
+        updateReadInterest();
+        memoryBudget_->countPausedRead();
+        scheduleBudgetRetry();
+        break;
+    case MemoryBudget::kRejectSend:
+        // 在sendInLoop中拒绝新的发送
+        break;
+    case MemoryBudget::kCloseLargest: {
+        const size_t connLimit = memoryBudget_->connectionLimit();
+        if (connLimit > 0 && bytes > connLimit) {
+            // 单个连接超出，它自己就是最大的
+            LOG_ERROR("TcpConnection [%s] holds %lu bytes over connection "
+                      "budget, force close",
+                      name().c_str(), bytes);
+            memoryBudget_->countForcedClose();
+            forceClose();
+        } else if (budgetOverflowCallback_) {
+            budgetOverflowCallback_();
+        }
+        break;
+    }
+    }
+}
+
+bool TcpConnection::overBudget() const {
+    const size_t connLimit = memoryBudget_->connectionLimit();
+    return (connLimit > 0 && chargedBytes_ > connLimit) ||
+           memoryBudget_->exceeded();
+}
+
+// 总预算可能因为其他loop上的连接而恢复，所以需要定时检查
+void TcpConnection::scheduleBudgetRetry() {
+    std::weak_ptr<TcpConnection> weakConn(shared_from_this());
+    loop_->runAfter(kBudgetRetrySeconds,
+                    std::bind(&TcpConnection::retryBudget, weakConn));
+}
+
+void TcpConnection::retryBudget(const std::weak_ptr<TcpConnection>& weakConn) {
+    TcpConnectionPtr conn(weakConn.lock());
+    if (conn) {
+        conn->retryBudgetInLoop();
+    }
+}
+
+void TcpConnection::retryBudgetInLoop() {
+    if (!budgetPaused_ || state_ == kDisconnected) {
+        return;
+    }
+    if (overBudget()) {
+        scheduleBudgetRetry();
+        return;
+    }
+    budgetPaused_ = false;
+    updateReadInterest();
+}
+
+// 两个缓冲区都没有待处理的数据时开始计时，空闲bufferReleaseDelay_秒后释放存储
+// 请求/响应的连接每条消息都会经过这里和markBuffersActive，所以两边都只做
+// 本loop计数器的读写和时间轮条目的刷新，不申请内存也没有跨线程的原子操作
+void TcpConnection::markBuffersIdle() {
+    if (buffersIdle_ || inputBuffer_.readableBytes() > 0 ||
+        outputBuffer_.readableBytes() > 0) {
+        return;
+    }
+    buffersIdle_ = true;
+    idleSince_ = loop_->pollReturnTime();
+    idleHeldBytes_ =
+        inputBuffer_.storageBytes() + outputBuffer_.storageBytes();
+    if (idleBufferBytes_) {
+        idleBufferBytes_->add(idleHeldBytes_);
+    }
+    if (bufferReleaseDelay_ > 0 && idleHeldBytes_ > 0 &&
+        state_ != kDisconnected) {
+        if (bufferReleaseEntry_.scheduled()) {
+            // 只修改到期格数，不移动链表节点
+            loop_->timingWheel()->refresh(&bufferReleaseEntry_);
+        } else {
+            loop_->timingWheel()->schedule(&bufferReleaseEntry_,
+                                           bufferReleaseDelay_);
+        }
+    }
+}
+
+// 有新的数据读入或者排队发送，不再是空闲状态
+// 时间轮上的条目不取消，到期时发现连接不空闲就什么也不做
+void TcpConnection::markBuffersActive() {
+    if (!buffersIdle_) {
+        return;
+    }
+    buffersIdle_ = false;
+    if (idleBufferBytes_) {
+        idleBufferBytes_->add(-static_cast<int64_t>(idleHeldBytes_));
+    }
+    idleHeldBytes_ = 0;
+}
+
+void TcpConnection::releaseIdleBuffersInLoop() {
+    if (!buffersIdle_ || idleHeldBytes_ == 0 || state_ == kDisconnected) {
+        return;
+    }
+    // 条目刷新时已经按最近一次空闲重新计时，这里只是防止提前释放
+    double idle = timeDifference(Timestamp::now(), idleSince_);
+    if (idle < bufferReleaseDelay_) {
+        loop_->timingWheel()->schedule(&bufferReleaseEntry_,
+                                       bufferReleaseDelay_ - idle);
+        return;
+    }
+    inputBuffer_.release();
+    outputBuffer_.release();
+    if (idleBufferBytes_) {
+        idleBufferBytes_->add(-static_cast<int64_t>(idleHeldBytes_));
+    }
+    idleHeldBytes_ = 0;
 }
 
 void TcpConnection::forceClose() {
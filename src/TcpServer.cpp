@@ -1,5 +1,9 @@
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
 #include <functional>
+#include <vector>
 
 #include "Logger.h"
 #include "TcpConnection.h"
@@ -19,27 +23,80 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& listenAddr,
     : loop_(CheckLoopNotNull(loop)),
       ipPort_(listenAddr.toIpPort()),
       name_(nameArg),
-      acceptor_(new Acceptor(loop, listenAddr, option == kReusePort)),
+      listenAddr_(listenAddr),
+      acceptPerLoop_(option == kReusePortPerLoop),
+      acceptor_(acceptPerLoop_
+                    ? nullptr
+                    : new Acceptor(loop, listenAddr, option == kReusePort)),
       threadPool_(new EventLoopThreadPool(loop, name_)),
       connectionCallback_(defaultConnectionCallback),
       messageCallback_(defaultMessageCallback),
+      started_(0),
       nextConnId_(1),
-      started_(0) {
+      connNamePrefix_(std::make_shared<const std::string>(nameArg + "-" +
+                                                           ipPort_)),
+      idleBufferReleaseSeconds_(0),
+      idleTimeoutSeconds_(0),
+      edgeTriggered_(false),
+      eventByteBudget_(TcpConnection::kEventByteBudget),
+      writeCoalescing_(false),
+      zeroCopyThreshold_(0),
+      zeroCopyCounters_(std::make_shared<ZeroCopyCounters>()),
+      budgetOverflowPending_(false),
+      nextShard_(0),
+      numConnections_(0) {
     // 当有新用户连接时，Acceptor类中绑定的acceptChannel_会有读事件发生，执行handleRead()调用TcpServer::newConnection回调
-    acceptor_->setNewConnectionCallback(
-        std::bind(&TcpServer::newConnection, this, std::placeholders::_1,
-                  std::placeholders::_2));
+    if (acceptor_) {
+        acceptor_->setNewConnectionCallback(
+            std::bind(&TcpServer::newConnection, this, std::placeholders::_1,
+                      std::placeholders::_2));
+    }
 }
 
 TcpServer::~TcpServer() {
-    for (auto& item : connections_) {
-        // 把原始的智能指针复位 让栈空间的TcpConnectionPtr conn指向该对象
-        // 当conn出了其作用域 即可释放智能指针指向的对象
-        TcpConnectionPtr conn(item.second);
-        item.second.reset();
-        // 销毁连接
-        conn->getLoop()->runInLoop(
-            std::bind(&TcpConnection::connectDestroyed, conn));
+    // 每个loop的监听socket和连接都要在所属的loop中销毁，并且要等销毁完成：
+    // subloop在TcpServer析构之后还会继续运行，如果只是把销毁排进队列，
+    // 排在前面的关闭事件仍然会回调removeConnection，访问已经释放的连接表
+    for (auto& shard : shards_) {
+        ConnectionShard* s = shard.get();
+        if (s->loop->isInLoopThread()) {
+            destroyShardInLoop(s);
+            continue;
+        }
+        std::mutex              mutex;
+        std::condition_variable cond;
+        bool                    done = false;
+        s->loop->runInLoop([this, s, &mutex, &cond, &done]() {
+            destroyShardInLoop(s);
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            cond.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!done) {
+            cond.wait(lock);
+        }
+    }
+}
+
+// 在shard所属的loop中关闭监听socket，销毁还登记着的连接
+void TcpServer::destroyShardInLoop(ConnectionShard* shard) {
+    shard->acceptor.reset();
+    ConnectionMap connections;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        connections.swap(shard->connections);
+        shard->freeSlots.clear();
+    }
+    for (TcpConnectionPtr& conn : connections) {
+        if (!conn) {
+            continue;
+        }
+        --numConnections_;
+        // 用户手里的连接之后还可能被关闭，不能再回调到已经析构的TcpServer
+        conn->setCloseCallback([](const TcpConnectionPtr&) {});
+        // 表里的智能指针已经换出，销毁之后连接随最后一个引用释放
+        conn->connectDestroyed();
     }
 }
 
@@ -52,26 +109,68 @@ void TcpServer::setThreadNum(int numThreads) {
 void TcpServer::start() {
     if (started_++ == 0) {  // 防止一个TcpServer对象被start多次
         threadPool_->start(threadInitCallback_);  // 启动底层的loop线程池
-        // acceptor_对象绑定listen函数，开始监听
-        loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        // 每个loop一张连接表，没有subloop时只有baseLoop一张
+        std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+        if (loops.size() > kMaxShards) {
+            LOG_FATAL("TcpServer [%s] supports at most %lu loops, got %lu",
+                      name_.c_str(), kMaxShards, loops.size());
+        }
+        for (size_t i = 0; i < loops.size(); ++i) {
+            std::unique_ptr<ConnectionShard> shard(new ConnectionShard);
+            shard->loop = loops[i];
+            shard->index = static_cast<uint32_t>(i);
+            shard->idleBufferBytes = std::make_shared<IdleBytesCounter>();
+            shards_.push_back(std::move(shard));
+        }
+        if (acceptPerLoop_) {
+            // 每个loop绑定同一个地址，在各自的loop中开始监听
+            for (auto& shard : shards_) {
+                shard->acceptor.reset(
+                    new Acceptor(shard->loop, listenAddr_, true));
+                shard->acceptor->setNewConnectionCallback(std::bind(
+                    &TcpServer::newConnectionLocal, this, shard.get(),
+                    std::placeholders::_1, std::placeholders::_2));
+                shard->loop->runInLoop(
+                    std::bind(&Acceptor::listen, shard->acceptor.get()));
+            }
+        } else {
+            // acceptor_对象绑定listen函数，开始监听
+            loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        }
     }
 }
 
 // 有一个新用户连接，acceptor会执行这个回调操作，
 // 负责将mainLoop接收到的请求连接(acceptChannel_会有读事件发生)通过回调轮询分发给subLoop去处理
+// mainLoop只分配序号和选择subLoop，连接的创建和登记都在subLoop中完成
 void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
     // 轮询算法 选择一个subLoop 来管理connfd对应的channel
-    EventLoop* ioLoop = threadPool_->getNextLoop();
-    char       buf[64] = {0};
-    snprintf(buf, sizeof buf, "-%s#%d", ipPort_.c_str(), nextConnId_);
+    ConnectionShard* shard = shards_[nextShard_].get();
+    nextShard_ = (nextShard_ + 1) % shards_.size();
+
+    const uint64_t seq = nextConnId_.fetch_add(1, std::memory_order_relaxed);
+
+    LOG_INFO("TcpServer::newConnection [%s] - new connection #%lu from %s",
+             name_.c_str(), seq, peerAddr.toIpPort().c_str());
+
+    shard->loop->runInLoop(std::bind(&TcpServer::newConnectionInLoop, this,
+                                     shard, seq, sockfd, peerAddr));
+}
 
-    // 这里没有设置为原子类是因为其只在mainloop中执行 不涉及线程安全问题
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+// 在接受连接的loop中直接建立连接
+void TcpServer::newConnectionLocal(ConnectionShard* shard, int sockfd,
+                                   const InetAddress& peerAddr) {
+    const uint64_t seq = nextConnId_.fetch_add(1, std::memory_order_relaxed);
 
-    LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s",
-             name_.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
+    LOG_INFO("TcpServer::newConnectionLocal [%s] - new connection #%lu "
+             "from %s on loop %u",
+             name_.c_str(), seq, peerAddr.toIpPort().c_str(), shard->index);
 
+    newConnectionInLoop(shard, seq, sockfd, peerAddr);
+}
+
+void TcpServer::newConnectionInLoop(ConnectionShard* shard, uint64_t seq,
+                                    int sockfd, const InetAddress& peerAddr) {
     // 通过sockfd获取其绑定的本机的ip地址和端口信息
     sockaddr_in local;
     ::memset(&local, 0, sizeof(local));
@@ -79,36 +178,173 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
     if (::getsockname(sockfd, (sockaddr*)&local, &addrlen) < 0) {
         LOG_ERROR("sockets::getLocalAddr");
     }
-
     InetAddress localAddr(local);
+
+    // 锁内只分配槽位和登记连接，回调都在锁外执行
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    // 分配槽位和id，名字不在这里拼接
+    uint32_t slot;
+    if (!shard->freeSlots.empty()) {
+        slot = shard->freeSlots.back();
+        shard->freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(shard->connections.size());
+        if (slot > kSlotMask) {
+            lock.unlock();
+            LOG_ERROR("TcpServer [%s] too many connections on loop %u, "
+                      "drop #%lu",
+                      name_.c_str(), shard->index, seq);
+            ::close(sockfd);
+            return;
+        }
+        shard->connections.emplace_back();
+    }
+    const uint64_t connId = (seq << kSeqShift) |
+                            (static_cast<uint64_t>(shard->index) << kSlotBits) |
+                            slot;
+
     // 构建Connection的时候传入新的EventLoop，即将cfd事件处理分配给SubReactor
-    TcpConnectionPtr conn(
-        new TcpConnection(ioLoop, connName, sockfd, localAddr, peerAddr));
-    connections_[connName] = conn;  // 将这个连接放在连接列表中
+    TcpConnectionPtr conn(new TcpConnection(shard->loop, connId,
+                                            connNamePrefix_, sockfd,
+                                            localAddr, peerAddr));
+    shard->connections[slot] = conn;  // 将这个连接放在本loop的连接表中
+    lock.unlock();
+    ++numConnections_;
     // 下面的回调都是用户设置给TcpServer => TcpConnection的，
     // 至于Channel绑定的则是TcpConnection设置的四个，handleRead,handleWrite...
     // 这下面的回调用于handlexxx函数中
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setIdleBufferRelease(idleBufferReleaseSeconds_,
+                               shard->idleBufferBytes);
+    conn->setIdleTimeout(idleTimeoutSeconds_);
+    conn->setEdgeTriggered(edgeTriggered_, eventByteBudget_);
+    conn->setWriteCoalescing(writeCoalescing_);
+    if (zeroCopyThreshold_ > 0) {
+        conn->setZeroCopy(zeroCopyThreshold_, zeroCopyCounters_);
+    }
+    if (memoryBudget_) {
+        conn->setMemoryBudget(memoryBudget_,
+                              std::bind(&TcpServer::onBudgetOverflow, this));
+        conn->setSendRejectedCallback(sendRejectedCallback_);
+    }
 
     // 设置了如何关闭连接的回调
     conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this,
                                      std::placeholders::_1));
 
-    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+    // 已经在conn所属的loop中，直接建立连接
+    conn->connectEstablished();
 }
 
+TcpConnectionPtr TcpServer::connection(uint64_t id) const {
+    const uint32_t index = static_cast<uint32_t>(id) >> kSlotBits;
+    const uint32_t slot = static_cast<uint32_t>(id) & kSlotMask;
+    if (index >= shards_.size()) {
+        return TcpConnectionPtr();
+    }
+    const ConnectionShard&      shard = *shards_[index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (slot < shard.connections.size() && shard.connections[slot] &&
+        shard.connections[slot]->id() == id) {
+        return shard.connections[slot];
+    }
+    return TcpConnectionPtr();
+}
+
+int64_t TcpServer::idleBufferBytes() const {
+    int64_t bytes = 0;
+    for (const auto& shard : shards_) {
+        bytes += shard->idleBufferBytes->get();
+    }
+    return bytes;
+}
+
+void TcpServer::forEachConnection(
+    const std::function<void(const TcpConnectionPtr&)>& f) const {
+    std::vector<TcpConnectionPtr> snapshot;
+    for (const auto& shard : shards_) {
+        snapshot.clear();
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            snapshot.reserve(shard->connections.size());
+            for (const TcpConnectionPtr& conn : shard->connections) {
+                if (conn) {
+                    snapshot.push_back(conn);
+                }
+            }
+        }
+        for (const TcpConnectionPtr& conn : snapshot) {
+            f(conn);
+        }
+    }
+}
+
+// 由TcpConnection::handleClose在连接所属的loop中调用，
+// 从该loop的连接表中删除后直接在同一个loop中销毁，不再经过mainLoop
 void TcpServer::removeConnection(const TcpConnectionPtr& conn) {
-    loop_->runInLoop(
-        std::bind(&TcpServer::removeConnectionInLoop, this, conn));
+    LOG_INFO("TcpServer::removeConnection [%s] - connection #%lu",
+             name_.c_str(), conn->id() >> kSeqShift);
+
+    const uint32_t index = static_cast<uint32_t>(conn->id()) >> kSlotBits;
+    const uint32_t slot = static_cast<uint32_t>(conn->id()) & kSlotMask;
+    if (index < shards_.size()) {
+        ConnectionShard&            shard = *shards_[index];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (slot < shard.connections.size() &&
+            shard.connections[slot] == conn) {
+            shard.connections[slot].reset();
+            shard.freeSlots.push_back(slot);
+            --numConnections_;
+        }
+    }
+    // 当前还在channel的事件处理中，channel要等这一轮事件处理完再移除
+    conn->getLoop()->queueInLoop(
+        std::bind(&TcpConnection::connectDestroyed, conn));
 }
 
-void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn) {
-    LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s",
-             name_.c_str(), conn->name().c_str());
+// 在各个subloop中调用，合并成mainLoop中的一次扫描
+void TcpServer::onBudgetOverflow() {
+    if (!budgetOverflowPending_.exchange(true)) {
+        loop_->queueInLoop(
+            std::bind(&TcpServer::closeLargestConnectionsInLoop, this));
+    }
+}
 
-    connections_.erase(conn->name());
-    EventLoop* ioLoop = conn->getLoop();
-    ioLoop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
-}
\ No newline at end of file
+void TcpServer::closeLargestConnectionsInLoop() {
+    budgetOverflowPending_ = false;
+    int64_t excess = memoryBudget_->usage() -
+                     static_cast<int64_t>(memoryBudget_->limit());
+    if (excess <= 0) {
+        return;
+    }
+    std::vector<std::pair<size_t, TcpConnectionPtr>> conns;
+    conns.reserve(numConnections_);
+    forEachConnection([&](const TcpConnectionPtr& conn) {
+        size_t bytes = conn->bufferedBytes();
+        if (!conn->connected()) {
+            // 已经在关闭的连接很快会释放这些字节
+            excess -= static_cast<int64_t>(bytes);
+        } else if (bytes > 0) {
+            conns.push_back(std::make_pair(bytes, conn));
+        }
+    });
+    std::sort(conns.begin(), conns.end(),
+              [](const std::pair<size_t, TcpConnectionPtr>& a,
+                 const std::pair<size_t, TcpConnectionPtr>& b) {
+                  return a.first > b.first;
+              });
+    // 从占用最多的开始关闭，直到释放的字节数足够回到预算之内
+    for (const auto& item : conns) {
+        if (excess <= 0) {
+            break;
+        }
+        LOG_ERROR("TcpServer [%s] over memory budget, force close [%s] "
+                  "holding %lu bytes",
+                  name_.c_str(), item.second->name().c_str(), item.first);
+        memoryBudget_->countForcedClose();
+        item.second->forceClose();
+        excess -= static_cast<int64_t>(item.first);
+    }
+}
@@ -1,17 +1,24 @@
 #include "Timestamp.h"
 
+#include <sys/time.h>
 #include <time.h>
 
 Timestamp::Timestamp() : microSecondsSinceEpoch_(0) {}
 Timestamp::Timestamp(int64_t microSecondsSinceEpoch)
     : microSecondsSinceEpoch_(microSecondsSinceEpoch) {}
+// 精确到微秒，定时器和空闲时间的计算都依赖这个精度
 Timestamp Timestamp::now() {
-    return Timestamp(time(NULL));
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return Timestamp(static_cast<int64_t>(tv.tv_sec) * kMicroSecondsPerSecond +
+                     tv.tv_usec);
 }
 
 std::string Timestamp::toString() const {
-    char buf[128] = {0};
-    tm*  tm_time = localtime(&microSecondsSinceEpoch_);
+    char   buf[128] = {0};
+    time_t seconds =
+        static_cast<time_t>(microSecondsSinceEpoch_ / kMicroSecondsPerSecond);
+    tm* tm_time = localtime(&seconds);
     snprintf(buf, 128, "%4d/%02d/%02d %02d:%02d:%02d",
              tm_time->tm_year + 1900, tm_time->tm_mon + 1, tm_time->tm_mday,
              tm_time->tm_hour, tm_time->tm_min, tm_time->tm_sec);
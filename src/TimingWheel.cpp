@@ -0,0 +1,104 @@
+#include <math.h>
+
+#include "EventLoop.h"
+#include "Logger.h"
+#include "TimingWheel.h"
+
+TimingWheel::Entry::Entry(Callback cb)
+    : cb_(std::move(cb)), wheel_(nullptr), deadline_(0), timeoutTicks_(0) {
+    prev = next = nullptr;
+}
+
+TimingWheel::Entry::~Entry() {
+    if (wheel_ != nullptr) {
+        wheel_->cancel(this);
+    }
+}
+
+TimingWheel::TimingWheel(EventLoop* loop, double tickSeconds,
+                         size_t numSlots)
+    : loop_(loop),
+      tickSeconds_(tickSeconds),
+      slots_(numSlots > 0 ? numSlots : 1),
+      currentTick_(0),
+      size_(0),
+      ticking_(false) {
+    for (Link& slot : slots_) {
+        slot.prev = slot.next = &slot;
+    }
+}
+
+TimingWheel::~TimingWheel() {
+    if (ticking_) {
+        loop_->cancel(tickTimer_);
+    }
+    // 还挂着的条目只是和时间轮脱离关系，不执行回调
+    for (Link& slot : slots_) {
+        for (Link* node = slot.next; node != &slot; node = node->next) {
+            static_cast<Entry*>(node)->wheel_ = nullptr;
+        }
+    }
+}
+
+void TimingWheel::schedule(Entry* entry, double seconds) {
+    if (entry->wheel_ != nullptr) {
+        entry->wheel_->cancel(entry);
+    }
+    // 当前这一格已经走过了一部分，多加一格保证不会提前触发
+    uint64_t ticks = static_cast<uint64_t>(::ceil(seconds / tickSeconds_));
+    entry->timeoutTicks_ = ticks + 1;
+    entry->deadline_ = currentTick_ + entry->timeoutTicks_;
+    entry->wheel_ = this;
+    linkBefore(slotFor(entry->deadline_), entry);
+    ++size_;
+
+    if (!ticking_) {
+        ticking_ = true;
+        tickTimer_ = loop_->runEvery(tickSeconds_,
+                                     std::bind(&TimingWheel::tick, this));
+    }
+}
+
+void TimingWheel::cancel(Entry* entry) {
+    if (entry->wheel_ != this) {
+        return;
+    }
+    unlink(entry);
+    entry->prev = entry->next = nullptr;
+    entry->wheel_ = nullptr;
+    --size_;
+}
+
+void TimingWheel::tick() {
+    ++currentTick_;
+    Link* slot = slotFor(currentTick_);
+    if (slot->next != slot) {
+        // 先把整个槽摘到临时链表上，回调中重新调度到这个槽的条目留到下一圈
+        Link pending;
+        pending.next = slot->next;
+        pending.prev = slot->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        slot->prev = slot->next = slot;
+
+        // 回调可能取消或者销毁其他条目，所以每次都从头取
+        while (pending.next != &pending) {
+            Entry* entry = static_cast<Entry*>(pending.next);
+            unlink(entry);
+            if (entry->deadline_ > currentTick_) {
+                // 刷新过或者还要再转几圈，挪到到期的槽里
+                linkBefore(slotFor(entry->deadline_), entry);
+            } else {
+                entry->prev = entry->next = nullptr;
+                entry->wheel_ = nullptr;
+                --size_;
+                entry->cb_();
+            }
+        }
+    }
+
+    if (size_ == 0 && ticking_) {
+        ticking_ = false;
+        loop_->cancel(tickTimer_);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <new>
+
+// 替换全局的operator new，统计当前线程在一段代码中申请内存的次数
+// 替换函数每个程序只能定义一次，只在测试的main文件中包含这个头文件
+// 只统计调用了AllocCounter::start()的线程，其他线程（例如客户端线程）不受影响
+
+namespace AllocCounter {
+
+__thread bool   t_counting = false;
+__thread size_t t_allocations = 0;
+
+// 开始统计当前线程的申请次数
+inline void start() {
+    t_allocations = 0;
+    t_counting = true;
+}
+
+// 停止统计，返回start()之后的申请次数
+inline size_t stop() {
+    t_counting = false;
+    return t_allocations;
+}
+
+}  // namespace AllocCounter
+
+void* operator new(size_t size) {
+    if (AllocCounter::t_counting) {
+        ++AllocCounter::t_allocations;
+    }
+    void* p = ::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    ::free(p);
+}
@@ -0,0 +1,92 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AllocCounter.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "SharedPayload.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "TestUtil.h"
+
+// 广播时每个连接只挂SharedPayload的引用，统计loop线程里一次广播申请内存的次数
+static const int kClients = 32;
+
+struct BroadcastResult {
+    size_t writableAllocs;  // 对端都能收下，数据直接写出去
+    size_t queuedAllocs;    // 对端不读，每个连接都要把尾部排进outputBuffer_
+};
+
+static BroadcastResult runBroadcast(uint16_t port) {
+    EventLoop                     loop;
+    TcpServer                     server(&loop, InetAddress(port), "Broadcast");
+    std::vector<TcpConnectionPtr> conns;
+    conns.reserve(kClients);
+    std::atomic<int> connected(0);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conns.push_back(conn);
+            ++connected;
+        }
+    });
+    server.start();
+
+    BroadcastResult result = {0, 0};
+    const SharedPayloadPtr small = SharedPayload::create(std::string(100, 's'));
+    const SharedPayloadPtr large =
+        SharedPayload::create(std::string(4 * 1024 * 1024, 'L'));
+    std::atomic<int> rounds(0);
+    auto broadcast = [&](const SharedPayloadPtr& payload, size_t* allocs) {
+        AllocCounter::start();
+        for (const TcpConnectionPtr& conn : conns) {
+            conn->send(payload);
+        }
+        *allocs = AllocCounter::stop();
+        ++rounds;
+    };
+
+    std::thread client([&]() {
+        std::vector<int> socks;
+        for (int i = 0; i < kClients; ++i) {
+            socks.push_back(connectLoopback(port));
+        }
+        while (connected < kClients) {
+            ::usleep(1000);
+        }
+        loop.runInLoop([&]() { broadcast(small, &result.writableAllocs); });
+        for (int sock : socks) {
+            CHECK(readFor(sock, small->size()) ==
+                  std::string(small->data(), small->size()));
+        }
+        loop.runInLoop([&]() { broadcast(large, &result.queuedAllocs); });
+        while (rounds < 2) {
+            ::usleep(1000);
+        }
+        for (int sock : socks) {
+            CHECK(readFor(sock, large->size()).size() == large->size());
+            ::close(sock);
+        }
+        loop.quit();
+    });
+    loop.runAfter(20.0, [&loop]() { loop.quit(); });
+    loop.loop();
+    client.join();
+    CHECK(rounds == 2);
+    return result;
+}
+
+int main() {
+    BroadcastResult result = runBroadcast(19311);
+    ::printf("allocations per broadcast to %d connections: writable %lu, "
+             "queued %lu\n",
+             kClients, result.writableAllocs, result.queuedAllocs);
+    // 能直接写出去时一次都不申请
+    CHECK(result.writableAllocs == 0);
+    // 排队时只挂引用，偶尔为块链表或者poller的兴趣表扩容，平均每个连接不到一次
+    CHECK(result.queuedAllocs <= kClients);
+    return 0;
+}
@@ -0,0 +1,305 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "Buffer.h"
+#include "SharedPayload.h"
+#include "TestUtil.h"
+
+// 分段模式的空缓冲区没有任何块，readFd要先挂一个尾块再读
+static void testSegmentedReadFdWithoutBlocks() {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    Buffer buf(Buffer::kSegmented);
+    CHECK(buf.writableBytes() == 0);
+    CHECK(::write(fds[1], "hello", 5) == 5);
+    int     savedErrno = 0;
+    ssize_t n = buf.readFd(fds[0], &savedErrno);
+    CHECK(n == 5);
+    CHECK(buf.readableBytes() == 5);
+    CHECK(buf.retrieveAllAsString() == "hello");
+
+    // 对端关闭，读到0字节时缓冲区保持为空
+    Buffer eof(Buffer::kSegmented);
+    ::close(fds[1]);
+    n = eof.readFd(fds[0], &savedErrno);
+    CHECK(n == 0);
+    CHECK(eof.readableBytes() == 0);
+    ::close(fds[0]);
+}
+
+// 尾块是引用的SharedPayload时没有可写空间，读到的数据要放进新块
+static void testSegmentedReadFdAfterSharedTail() {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    Buffer buf(Buffer::kSegmented);
+    buf.appendShared(SharedPayload::create("head", 4));
+    CHECK(buf.writableBytes() == 0);
+    CHECK(::write(fds[1], "tail", 4) == 4);
+    int savedErrno = 0;
+    CHECK(buf.readFd(fds[0], &savedErrno) == 4);
+    CHECK(buf.retrieveAllAsString() == "headtail");
+
+    ::close(fds[1]);
+    CHECK(buf.readFd(fds[0], &savedErrno) == 0);
+    CHECK(buf.readableBytes() == 0);
+    ::close(fds[0]);
+}
+
+// 超过一个块的数据先读进尾块，剩下的经过栈上缓冲区追加到新块
+static void testSegmentedReadFdSpansBlocks() {
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    const int size = 32 * 1024;
+    CHECK(::setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof size) ==
+          0);
+
+    std::string data(3000, 'x');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>('a' + i % 26);
+    }
+    Buffer buf(Buffer::kSegmented, 1024);
+    CHECK(::write(fds[1], data.data(), data.size()) ==
+          static_cast<ssize_t>(data.size()));
+    int savedErrno = 0;
+    CHECK(buf.readFd(fds[0], &savedErrno) ==
+          static_cast<ssize_t>(data.size()));
+    CHECK(buf.readableBytes() == data.size());
+    CHECK(buf.retrieveAllAsString() == data);
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// 两种模式各测一遍；分段模式用很小的块，数据会跨块，peek要先合并
+static Buffer makeBuffer(bool segmented) {
+    return segmented ? Buffer(Buffer::kSegmented, 16) : Buffer();
+}
+
+static std::string bytes(const char* data, size_t len) {
+    return std::string(data, len);
+}
+
+// 整数按大端读写：检查写进去的字节，再按原样读回来
+static void testIntByteOrder(bool segmented) {
+    Buffer buf = makeBuffer(segmented);
+    buf.appendInt64(0x0102030405060708LL);
+    buf.appendInt32(0x090a0b0c);
+    buf.appendInt16(0x0d0e);
+    buf.appendInt8(0x0f);
+    CHECK(buf.readableBytes() == 15);
+    CHECK(bytes(buf.peek(), 15) ==
+          std::string("\x01\x02\x03\x04\x05\x06\x07\x08"
+                      "\x09\x0a\x0b\x0c\x0d\x0e\x0f",
+                      15));
+    CHECK(buf.peekInt64() == 0x0102030405060708LL);
+    CHECK(buf.readInt64() == 0x0102030405060708LL);
+    CHECK(buf.peekInt32() == 0x090a0b0c);
+    CHECK(buf.readInt32() == 0x090a0b0c);
+    CHECK(buf.peekInt16() == 0x0d0e);
+    CHECK(buf.readInt16() == 0x0d0e);
+    CHECK(buf.peekInt8() == 0x0f);
+    CHECK(buf.readInt8() == 0x0f);
+    CHECK(buf.readableBytes() == 0);
+
+    // 负数和最高位为1的值
+    buf.appendInt64(INT64_MIN);
+    buf.appendInt32(-2);
+    buf.appendInt16(INT16_MIN);
+    buf.appendInt8(-1);
+    CHECK(buf.readInt64() == INT64_MIN);
+    CHECK(buf.readInt32() == -2);
+    CHECK(buf.readInt16() == INT16_MIN);
+    CHECK(buf.readInt8() == -1);
+
+    // prepend写在前面，字节序和append一致；连续模式只预留了kCheapPretend字节
+    buf.append("body", 4);
+    buf.prependInt8(0x0f);
+    buf.prependInt16(0x0d0e);
+    buf.prependInt32(0x090a0b0c);
+    CHECK(buf.readableBytes() == 11);
+    CHECK(bytes(buf.peek(), 11) ==
+          std::string("\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+                      "body",
+                      11));
+    CHECK(buf.readInt32() == 0x090a0b0c);
+    CHECK(buf.readInt16() == 0x0d0e);
+    CHECK(buf.readInt8() == 0x0f);
+    CHECK(buf.retrieveAllAsString() == "body");
+
+    buf.append("body", 4);
+    buf.prependInt64(0x0102030405060708LL);
+    CHECK(bytes(buf.peek(), 12) ==
+          std::string("\x01\x02\x03\x04\x05\x06\x07\x08"
+                      "body",
+                      12));
+    CHECK(buf.readInt64() == 0x0102030405060708LL);
+    CHECK(buf.retrieveAllAsString() == "body");
+}
+
+// 从奇数偏移读各种宽度的整数
+static void testIntUnaligned(bool segmented) {
+    Buffer buf = makeBuffer(segmented);
+    buf.appendInt8(0x7f);
+    buf.appendInt64(-0x0102030405060708LL);
+    buf.appendInt8(0x01);
+    buf.appendInt32(-0x090a0b0c);
+    buf.appendInt8(0x02);
+    buf.appendInt16(-0x0d0e);
+    CHECK(buf.readInt8() == 0x7f);
+    if (!segmented) {
+        CHECK(reinterpret_cast<uintptr_t>(buf.peek()) % 2 == 1);
+    }
+    CHECK(buf.readInt64() == -0x0102030405060708LL);
+    CHECK(buf.readInt8() == 0x01);
+    CHECK(buf.readInt32() == -0x090a0b0c);
+    CHECK(buf.readInt8() == 0x02);
+    CHECK(buf.readInt16() == -0x0d0e);
+    CHECK(buf.readableBytes() == 0);
+}
+
+// 编码后再读回来，返回占用的字节数
+static int varintRoundTrip(bool segmented, uint64_t x) {
+    Buffer buf = makeBuffer(segmented);
+    buf.appendVarUint64(x);
+    const size_t encoded = buf.readableBytes();
+    uint64_t     decoded = 0;
+    const int    n = buf.readVarUint64(&decoded);
+    CHECK(n == static_cast<int>(encoded));
+    CHECK(decoded == x);
+    CHECK(buf.readableBytes() == 0);
+    return n;
+}
+
+static void testVarintRoundTrip(bool segmented) {
+    CHECK(varintRoundTrip(segmented, 0) == 1);
+    CHECK(varintRoundTrip(segmented, 127) == 1);
+    CHECK(varintRoundTrip(segmented, 128) == 2);
+    CHECK(varintRoundTrip(segmented, 16383) == 2);
+    CHECK(varintRoundTrip(segmented, 16384) == 3);
+    CHECK(varintRoundTrip(segmented, (1ULL << 56) - 1) == 8);
+    CHECK(varintRoundTrip(segmented, 1ULL << 56) == 9);
+    CHECK(varintRoundTrip(segmented, 1ULL << 63) == 10);
+    CHECK(varintRoundTrip(segmented, UINT64_MAX) == 10);
+
+    // zigzag：绝对值小的负数也只占一个字节，两端的极值能还原
+    CHECK(Buffer::zigzagEncode(0) == 0);
+    CHECK(Buffer::zigzagEncode(-1) == 1);
+    CHECK(Buffer::zigzagEncode(1) == 2);
+    CHECK(Buffer::zigzagEncode(INT64_MAX) == UINT64_MAX - 1);
+    CHECK(Buffer::zigzagEncode(INT64_MIN) == UINT64_MAX);
+    const int64_t values[] = {0, -1, 1, -64, 63, INT64_MIN, INT64_MAX};
+    for (int64_t v : values) {
+        Buffer buf = makeBuffer(segmented);
+        buf.appendVarInt64(v);
+        int64_t decoded = 0;
+        CHECK(buf.readVarInt64(&decoded) > 0);
+        CHECK(decoded == v);
+        CHECK(buf.readableBytes() == 0);
+    }
+    Buffer small = makeBuffer(segmented);
+    small.appendVarInt64(-64);
+    CHECK(small.readableBytes() == 1);
+}
+
+// 可读数据不少于8字节时走一次取8字节的快速路径，否则逐字节解码，
+// 两条路径对1到8字节长的每一种varint结果一致
+static void testVarintFastPathMatchesTail(bool segmented) {
+    for (int len = 1; len <= 8; ++len) {
+        const uint64_t x = (1ULL << (7 * len)) - 1;  // 恰好占len个字节
+        Buffer         exact = makeBuffer(segmented);
+        exact.appendVarUint64(x);
+        CHECK(exact.readableBytes() == static_cast<size_t>(len));
+
+        Buffer padded = makeBuffer(segmented);
+        padded.appendVarUint64(x);
+        padded.append("\x80\x80\x80\x80\x80\x80\x80\x80", 8);
+
+        uint64_t fromTail = 0;
+        uint64_t fromWord = 0;
+        CHECK(exact.peekVarUint64(&fromTail) == len);
+        CHECK(padded.peekVarUint64(&fromWord) == len);
+        CHECK(fromTail == x);
+        CHECK(fromWord == x);
+        CHECK(padded.readVarUint64(&fromWord) == len);
+        CHECK(padded.readableBytes() == 8);
+    }
+    // 9、10字节的数后面跟着数据，快速路径找不到结束字节，退回逐字节解码
+    Buffer buf = makeBuffer(segmented);
+    buf.appendVarUint64(1ULL << 56);
+    buf.appendVarUint64(UINT64_MAX);
+    buf.appendVarUint64(5);
+    uint64_t x = 0;
+    CHECK(buf.readVarUint64(&x) == 9);
+    CHECK(x == 1ULL << 56);
+    CHECK(buf.readVarUint64(&x) == 10);
+    CHECK(x == UINT64_MAX);
+    CHECK(buf.readVarUint64(&x) == 1);
+    CHECK(x == 5);
+}
+
+// 数据不完整返回0，不回收任何字节
+static void testVarintIncomplete(bool segmented) {
+    Buffer   buf = makeBuffer(segmented);
+    uint64_t x = 42;
+    CHECK(buf.peekVarUint64(&x) == 0);
+    buf.append("\xff\xff", 2);
+    CHECK(buf.peekVarUint64(&x) == 0);
+    CHECK(buf.readVarUint64(&x) == 0);
+    CHECK(buf.readableBytes() == 2);
+    // 8、9个字节都没有结束字节，数据不足kMaxVarintBytes仍然是不完整
+    buf.append("\xff\xff\xff\xff\xff\xff", 6);
+    CHECK(buf.peekVarUint64(&x) == 0);
+    buf.append("\xff", 1);
+    CHECK(buf.peekVarUint64(&x) == 0);
+    CHECK(x == 42);
+    // 补上结束字节之后能解出来
+    buf.append("\x01", 1);
+    CHECK(buf.readVarUint64(&x) == 10);
+    CHECK(x == UINT64_MAX);
+}
+
+// 超过10字节仍未结束，或者第10个字节超出uint64_t的范围，返回-1
+static void testVarintMalformed(bool segmented) {
+    uint64_t x = 42;
+    Buffer   overlong = makeBuffer(segmented);
+    overlong.append("\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x00", 11);
+    CHECK(overlong.peekVarUint64(&x) == -1);
+    CHECK(overlong.readVarUint64(&x) == -1);
+    CHECK(overlong.readableBytes() == 11);
+
+    Buffer overflow = makeBuffer(segmented);
+    overflow.append("\xff\xff\xff\xff\xff\xff\xff\xff\xff\x02", 10);
+    CHECK(overflow.peekVarUint64(&x) == -1);
+    int64_t s = 0;
+    CHECK(overflow.readVarInt64(&s) == -1);
+    CHECK(overflow.readableBytes() == 10);
+
+    // 第10个字节为0也是合法编码（冗余的高位），为1是最高位
+    Buffer top = makeBuffer(segmented);
+    top.append("\x80\x80\x80\x80\x80\x80\x80\x80\x80\x01", 10);
+    CHECK(top.readVarUint64(&x) == 10);
+    CHECK(x == 1ULL << 63);
+}
+
+static void testCodecs(bool segmented) {
+    testIntByteOrder(segmented);
+    testIntUnaligned(segmented);
+    testVarintRoundTrip(segmented);
+    testVarintFastPathMatchesTail(segmented);
+    testVarintIncomplete(segmented);
+    testVarintMalformed(segmented);
+}
+
+int main() {
+    testSegmentedReadFdWithoutBlocks();
+    testSegmentedReadFdAfterSharedTail();
+    testSegmentedReadFdSpansBlocks();
+    testCodecs(false);
+    testCodecs(true);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "ByteSearch.h"
+#include "TestUtil.h"
+
+// 逐字节比较的参考实现
+static const char* naiveCRLF(const char* begin, const char* end) {
+    for (const char* p = begin; p + 1 < end; ++p) {
+        if (p[0] == '\r' && p[1] == '\n') {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static const char* naiveAnyOf(const char* begin, const char* end,
+                              const char* set, size_t n) {
+    for (const char* p = begin; p < end; ++p) {
+        if (::memchr(set, *p, n) != nullptr) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// 向量实现每次处理16/32字节，重点覆盖匹配落在块边界两侧、
+// "\r"和"\n"分属相邻两块、剩余不足一块交给标量尾部处理的情况
+static const size_t kMaxLen = 100;
+static const size_t kMaxOffset = 33;  // 起始地址不对齐
+
+static void checkCRLF(const std::string& data, size_t offset) {
+    const char* begin = data.data() + offset;
+    const char* end = data.data() + data.size();
+    CHECK(ByteSearch::findCRLF(begin, end) == naiveCRLF(begin, end));
+}
+
+static void testFindCRLF() {
+    for (size_t offset = 0; offset <= kMaxOffset; ++offset) {
+        for (size_t len = 0; len <= kMaxLen; ++len) {
+            std::string data(offset + len, 'x');
+            checkCRLF(data, offset);
+            for (size_t pos = 0; pos < len; ++pos) {
+                // 只有'\r'，或者'\r'在最后一个字节
+                std::string cr = data;
+                cr[offset + pos] = '\r';
+                checkCRLF(cr, offset);
+                // 只有'\n'
+                std::string lf = data;
+                lf[offset + pos] = '\n';
+                checkCRLF(lf, offset);
+                if (pos + 1 < len) {
+                    // 完整的CRLF，前面再放一个落单的'\r'
+                    std::string crlf = data;
+                    crlf[offset + pos] = '\r';
+                    crlf[offset + pos + 1] = '\n';
+                    checkCRLF(crlf, offset);
+                    if (pos > 0) {
+                        crlf[offset + pos - 1] = '\r';
+                        checkCRLF(crlf, offset);
+                    }
+                    // "\n\r"顺序反了，不算
+                    std::string lfcr = data;
+                    lfcr[offset + pos] = '\n';
+                    lfcr[offset + pos + 1] = '\r';
+                    checkCRLF(lfcr, offset);
+                }
+            }
+        }
+    }
+}
+
+static void checkAnyOf(const std::string& data, size_t offset,
+                       const std::string& set) {
+    const char* begin = data.data() + offset;
+    const char* end = data.data() + data.size();
+    CHECK(ByteSearch::findAnyOf(begin, end, set.data(), set.size()) ==
+          naiveAnyOf(begin, end, set.data(), set.size()));
+}
+
+static void testFindAnyOf() {
+    // 集合大小覆盖单字节（memchr）、向量实现和超过16个字节的查表实现
+    const size_t             sizes[] = {1, 2, 3, 8, 15, 16, 17, 20};
+    std::vector<std::string> sets;
+    for (size_t n : sizes) {
+        std::string set;
+        for (size_t i = 0; i < n; ++i) {
+            set.push_back(static_cast<char>(0x80 + i * 3));  // 含高位字节
+        }
+        sets.push_back(set);
+    }
+    for (const std::string& set : sets) {
+        for (size_t offset = 0; offset <= kMaxOffset; offset += 3) {
+            for (size_t len = 0; len <= kMaxLen; ++len) {
+                std::string data(offset + len, 'x');
+                checkAnyOf(data, offset, set);
+                for (size_t pos = 0; pos < len; ++pos) {
+                    std::string hit = data;
+                    hit[offset + pos] = set[pos % set.size()];
+                    checkAnyOf(hit, offset, set);
+                    // 起始位置之前的匹配不能算进来
+                    if (offset > 0) {
+                        hit[offset - 1] = set[0];
+                        checkAnyOf(hit, offset, set);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    const char* impls[] = {"scalar", "sse2", "avx2"};
+    int         tested = 0;
+    for (const char* name : impls) {
+        if (!ByteSearch::useImpl(name)) {
+            ::printf("%s unavailable, skipped\n", name);
+            continue;
+        }
+        CHECK(::strcmp(ByteSearch::implName(), name) == 0);
+        testFindCRLF();
+        testFindAnyOf();
+        ++tested;
+    }
+    CHECK(tested > 0);
+    return 0;
+}
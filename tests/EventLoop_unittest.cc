@@ -0,0 +1,151 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "AllocCounter.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "Task.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "TestUtil.h"
+
+// 捕获不超过Task::kInlineSize字节的回调，跨线程runInLoop/queueInLoop时
+// 生产者不申请内存，loop线程取出和执行也不申请内存
+static const int kRounds = 10;
+static const int kPerRound = 500;
+
+struct QueueState {
+    std::atomic<int>    executed;
+    std::atomic<size_t> loopAllocs;
+    int                 checksum;  // 只在loop线程中修改
+};
+
+// 一个指针、一个shared_ptr再加上40字节参数，正好占满内联存储
+struct TaskArgs {
+    char data[40];
+};
+
+static Task makeTask(QueueState* state, const std::shared_ptr<int>& ref,
+                     int i) {
+    TaskArgs args;
+    ::memset(args.data, 0, sizeof args.data);
+    args.data[0] = static_cast<char>(i & 1);
+    auto f = [state, ref, args]() {
+        int n = state->executed.load(std::memory_order_relaxed);
+        // 每一轮第一个回调开始统计loop线程，最后一个结束；第0轮用来预热
+        const bool measured = n >= kPerRound;
+        if (measured && n % kPerRound == 0) {
+            AllocCounter::start();
+        }
+        state->checksum += args.data[0] + *ref;
+        state->executed.store(n + 1, std::memory_order_release);
+        if (measured && (n + 1) % kPerRound == 0) {
+            state->loopAllocs += AllocCounter::stop();
+        }
+    };
+    static_assert(sizeof(f) == Task::kInlineSize, "capture should fit");
+    return Task(std::move(f));
+}
+
+static void testQueueInLoopNoAllocation() {
+    EventLoop            loop;
+    QueueState           state;
+    state.executed = 0;
+    state.loopAllocs = 0;
+    state.checksum = 0;
+    std::shared_ptr<int> ref = std::make_shared<int>(0);
+    size_t               producerAllocs = 0;
+    size_t               bigAllocs = 0;
+
+    std::thread producer([&]() {
+        for (int round = 0; round < kRounds; ++round) {
+            AllocCounter::start();
+            for (int i = 0; i < kPerRound; ++i) {
+                if (i % 2 == 0) {
+                    loop.runInLoop(makeTask(&state, ref, i));
+                } else {
+                    loop.queueInLoop(makeTask(&state, ref, i));
+                }
+            }
+            producerAllocs += AllocCounter::stop();
+            while (state.executed.load(std::memory_order_acquire) <
+                   (round + 1) * kPerRound) {
+                ::usleep(100);
+            }
+        }
+        // 超过内联存储的回调申请一次内存，说明计数确实生效
+        struct BigArgs {
+            char data[128];
+        };
+        BigArgs big = BigArgs();
+        AllocCounter::start();
+        loop.queueInLoop([big]() { (void)big; });
+        bigAllocs = AllocCounter::stop();
+        loop.quit();
+    });
+    loop.runAfter(10.0, [&loop]() { loop.quit(); });
+    loop.loop();
+    producer.join();
+
+    CHECK(state.executed == kRounds * kPerRound);
+    CHECK(state.checksum == kRounds * kPerRound / 2);
+    CHECK(producerAllocs == 0);
+    CHECK(state.loopAllocs == 0);
+    CHECK(bigAllocs == 1);
+}
+
+// 稳定状态下的echo：预热之后每条消息的读、回调和发送都不申请内存
+static void testEchoNoAllocation() {
+    const uint16_t kPort = 19312;
+    const int      kWarmup = 100;
+    const int      kMeasured = 1000;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "EchoAlloc");
+    int            messages = 0;
+    size_t         allocs = 0;
+    server.setMessageCallback(
+        [&](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+            if (messages == kWarmup) {
+                AllocCounter::start();
+            }
+            conn->send(buf);
+            ++messages;
+            if (messages == kWarmup + kMeasured) {
+                allocs = AllocCounter::stop();
+            }
+        });
+    server.start();
+
+    bool echoed = true;
+    std::thread client([&]() {
+        int               sock = connectLoopback(kPort);
+        const std::string message(64, 'm');
+        for (int i = 0; i < kWarmup + kMeasured; ++i) {
+            writeAll(sock, message);
+            if (readFor(sock, message.size()) != message) {
+                echoed = false;
+                break;
+            }
+        }
+        ::close(sock);
+        loop.quit();
+    });
+    loop.runAfter(10.0, [&loop]() { loop.quit(); });
+    loop.loop();
+    client.join();
+
+    CHECK(echoed);
+    CHECK(messages == kWarmup + kMeasured);
+    CHECK(allocs == 0);
+}
+
+int main() {
+    testQueueInLoopNoAllocation();
+    testEchoNoAllocation();
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "MemoryBudget.h"
+#include "SharedPayload.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "TestUtil.h"
+
+// 客户端接收缓冲区开得很小，服务器发出的大消息大部分都排在outputBuffer_中
+static const int    kSmallRcvbuf = 4096;
+static const size_t kLarge = 4 * 1024 * 1024;
+static const size_t kLimit = 1024 * 1024;
+
+// 服务器loop跑在当前线程，client在另一个线程中阻塞收发，返回后退出loop
+static void runWithClient(EventLoop* loop, const std::function<void()>& client) {
+    std::thread thread([loop, &client]() {
+        client();
+        loop->quit();
+    });
+    loop->runAfter(10.0, [loop]() { loop->quit(); });
+    loop->loop();
+    thread.join();
+}
+
+// 等到cond成立，最多等timeoutMs毫秒
+static bool waitFor(const std::function<bool()>& cond, int timeoutMs = 3000) {
+    for (int i = 0; i < timeoutMs; ++i) {
+        if (cond()) {
+            return true;
+        }
+        ::usleep(1000);
+    }
+    return cond();
+}
+
+static std::string makePattern(size_t len) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+        data[i] = static_cast<char>('a' + (i * 7) % 26);
+    }
+    return data;
+}
+
+// kStopReading：输出积压超出总预算后不再读对端的数据，积压发完之后恢复读
+static void testStopReading() {
+    const uint16_t kPort = 19321;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "StopReading");
+    MemoryBudgetPtr budget =
+        std::make_shared<MemoryBudget>(kLimit, 0, MemoryBudget::kStopReading);
+    server.setMemoryBudget(budget);
+    const std::string data = makePattern(kLarge);
+    server.setConnectionCallback([&data](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(data);  // 拷贝进连接自己的outputBuffer_
+        }
+    });
+    std::atomic_bool received(false);
+    server.setMessageCallback(
+        [&received](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+            received = true;
+            buf->retrieveAll();
+            conn->send(std::string("y"));
+        });
+    server.start();
+
+    bool        paused = false;
+    bool        readWhilePaused = true;
+    std::string body;
+    std::string reply;
+    bool        released = false;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort, kSmallRcvbuf);
+        paused = waitFor([&]() { return budget->pausedReads() == 1; });
+        writeAll(sock, "x");
+        ::usleep(200 * 1000);
+        readWhilePaused = received;
+        body = readFor(sock, kLarge);
+        reply = readFor(sock, 1);
+        released = waitFor([&]() { return budget->usage() == 0; });
+        ::close(sock);
+    });
+    CHECK(paused);
+    CHECK(!readWhilePaused);
+    CHECK(body == data);
+    CHECK(reply == "y");
+    CHECK(released);
+    CHECK(budget->pausedReads() == 1);
+    CHECK(budget->peak() > static_cast<int64_t>(kLimit));
+    CHECK(budget->peak() <= static_cast<int64_t>(kLarge));
+    CHECK(budget->rejectedSends() == 0);
+    CHECK(budget->forcedCloses() == 0);
+}
+
+// kRejectSend：已经有积压时，会超出预算的发送直接丢弃并回调，已经排队的数据照常发完
+static void testRejectSend() {
+    const uint16_t kPort = 19322;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "RejectSend");
+    MemoryBudgetPtr budget =
+        std::make_shared<MemoryBudget>(kLimit, 0, MemoryBudget::kRejectSend);
+    server.setMemoryBudget(budget);
+    size_t rejected = 0;
+    server.setSendRejectedCallback(
+        [&rejected](const TcpConnectionPtr&, size_t len) { rejected += len; });
+    const std::string data = makePattern(kLarge);
+    const std::string extra(1024, 'z');
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(data);   // 队列为空，先写一部分，剩下的全部排队
+            conn->send(extra);  // 排在积压后面会超出预算，被拒绝
+            conn->shutdown();
+        }
+    });
+    server.start();
+
+    std::string body;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort, kSmallRcvbuf);
+        ::usleep(100 * 1000);
+        body = readFor(sock, kLarge + extra.size());
+        ::close(sock);
+    });
+    CHECK(body == data);
+    CHECK(rejected == extra.size());
+    CHECK(budget->rejectedSends() == 1);
+    CHECK(budget->rejectedBytes() == static_cast<int64_t>(extra.size()));
+    CHECK(budget->pausedReads() == 0);
+    CHECK(budget->forcedCloses() == 0);
+}
+
+// kCloseLargest：总量超出时关闭积压最多的连接，其他连接不受影响
+static void testCloseLargest() {
+    const uint16_t kPort = 19323;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "CloseLargest");
+    MemoryBudgetPtr budget =
+        std::make_shared<MemoryBudget>(kLimit, 0, MemoryBudget::kCloseLargest);
+    server.setMemoryBudget(budget);
+    const std::string data = makePattern(kLarge);
+    const std::string small(16 * 1024, 's');
+    int               connections = 0;
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(++connections == 1 ? small : data);
+        }
+    });
+    server.setMessageCallback(
+        [](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+            conn->send(buf);
+        });
+    server.start();
+
+    std::string smallBody;
+    std::string largeBody;
+    std::string echo;
+    runWithClient(&loop, [&]() {
+        int quiet = connectLoopback(kPort);
+        smallBody = readFor(quiet, small.size());
+        int heavy = connectLoopback(kPort, kSmallRcvbuf);
+        waitFor([&]() { return budget->forcedCloses() > 0; });
+        largeBody = readFor(heavy, kLarge);
+        writeAll(quiet, "ping");
+        echo = readFor(quiet, 4);
+        ::close(heavy);
+        ::close(quiet);
+    });
+    CHECK(smallBody == small);
+    CHECK(largeBody.size() < kLarge);
+    CHECK(echo == "ping");
+    CHECK(budget->forcedCloses() == 1);
+    CHECK(budget->pausedReads() == 0);
+    CHECK(budget->rejectedSends() == 0);
+}
+
+// 单个连接的预算：只看连接自己持有的字节，超出的连接直接关闭；
+// 同样大小的SharedPayload不属于任何一个连接，不会触发
+static void testConnectionLimit() {
+    const uint16_t  kPort = 19324;
+    EventLoop       loop;
+    TcpServer       server(&loop, InetAddress(kPort), "ConnectionLimit");
+    MemoryBudgetPtr budget =
+        std::make_shared<MemoryBudget>(0, kLimit, MemoryBudget::kCloseLargest);
+    server.setMemoryBudget(budget);
+    const std::string      data = makePattern(kLarge);
+    const SharedPayloadPtr payload =
+        SharedPayload::create(data.data(), data.size());
+    int                    connections = 0;
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (!conn->connected()) {
+            return;
+        }
+        if (++connections == 1) {
+            conn->send(payload);
+        } else {
+            conn->send(data);
+        }
+    });
+    server.start();
+
+    std::string sharedBody;
+    std::string ownedBody;
+    runWithClient(&loop, [&]() {
+        int shared = connectLoopback(kPort, kSmallRcvbuf);
+        ::usleep(100 * 1000);
+        int owned = connectLoopback(kPort, kSmallRcvbuf);
+        waitFor([&]() { return budget->forcedCloses() > 0; });
+        ownedBody = readFor(owned, kLarge);
+        sharedBody = readFor(shared, kLarge);
+        ::close(owned);
+        ::close(shared);
+    });
+    CHECK(ownedBody.size() < kLarge);
+    CHECK(sharedBody == data);
+    CHECK(budget->forcedCloses() == 1);
+}
+
+// 同一个SharedPayload广播给多个积压的连接，总预算只计一份；
+// 每个连接都不计这部分，所以既不会关闭订阅者，也不会超出单个连接的预算
+static void testBroadcastChargedOnce() {
+    const uint16_t  kPort = 19325;
+    const int       kClients = 8;
+    EventLoop       loop;
+    TcpServer       server(&loop, InetAddress(kPort), "BudgetBroadcast");
+    MemoryBudgetPtr budget = std::make_shared<MemoryBudget>(
+        2 * kLarge, kLimit, MemoryBudget::kCloseLargest);
+    server.setMemoryBudget(budget);
+    std::vector<TcpConnectionPtr> conns;
+    std::atomic<int>              connected(0);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conns.push_back(conn);
+            ++connected;
+        }
+    });
+    server.start();
+
+    const std::string data = makePattern(kLarge);
+    SharedPayloadPtr  payload =
+        SharedPayload::create(data.data(), data.size());
+    std::atomic_bool  sent(false);
+    int64_t           usageQueued = 0;
+    size_t            maxBuffered = 0;
+    std::atomic_bool  dropped(false);
+    bool              allReceived = true;
+    bool              released = false;
+    runWithClient(&loop, [&]() {
+        std::vector<int> socks;
+        for (int i = 0; i < kClients; ++i) {
+            socks.push_back(connectLoopback(kPort, kSmallRcvbuf));
+        }
+        waitFor([&]() { return connected == kClients; });
+        loop.runInLoop([&]() {
+            for (const TcpConnectionPtr& conn : conns) {
+                conn->send(payload);
+            }
+            usageQueued = budget->usage();
+            for (const TcpConnectionPtr& conn : conns) {
+                maxBuffered = std::max(maxBuffered, conn->bufferedBytes());
+            }
+            sent = true;
+        });
+        waitFor([&]() { return sent.load(); });
+        for (int sock : socks) {
+            if (readFor(sock, kLarge) != data) {
+                allReceived = false;
+            }
+        }
+        // 应用放掉自己的引用之后，最后一个引用释放时退还预算
+        loop.runInLoop([&]() {
+            payload.reset();
+            dropped = true;
+        });
+        waitFor([&]() { return dropped.load(); });
+        released = waitFor([&]() { return budget->usage() == 0; });
+        for (int sock : socks) {
+            ::close(sock);
+        }
+    });
+    CHECK(sent);
+    CHECK(usageQueued == static_cast<int64_t>(kLarge));
+    CHECK(maxBuffered == 0);
+    CHECK(allReceived);
+    CHECK(released);
+    CHECK(budget->peak() == static_cast<int64_t>(kLarge));
+    CHECK(budget->forcedCloses() == 0);
+    CHECK(budget->pausedReads() == 0);
+    CHECK(budget->rejectedSends() == 0);
+}
+
+int main() {
+    testStopReading();
+    testRejectSend();
+    testCloseLargest();
+    testConnectionLimit();
+    testBroadcastChargedOnce();
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "AllocCounter.h"
+#include "MpscQueue.h"
+#include "Task.h"
+#include "TestUtil.h"
+
+// 数组没满时入队出队都只在格子里移动元素，不申请内存
+static void testNoAllocation() {
+    MpscQueue<Task> queue;
+    int             sum = 0;
+    AllocCounter::start();
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            queue.push([&sum, i]() { sum += i; });
+        }
+        Task task;
+        while (queue.pop(&task)) {
+            task();
+        }
+    }
+    size_t allocations = AllocCounter::stop();
+    CHECK(allocations == 0);
+    CHECK(sum == 10 * 999 * 1000 / 2);
+    CHECK(queue.empty());
+}
+
+// 数组很小，生产者频繁退到溢出队列，每个生产者的元素仍然按入队顺序取出
+static void testOverflowKeepsOrder() {
+    const int          kProducers = 4;
+    const uint64_t     kPerProducer = 200000;
+    MpscQueue<uint64_t> queue(4);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&queue, p, kPerProducer]() {
+            for (uint64_t i = 0; i < kPerProducer; ++i) {
+                queue.push((static_cast<uint64_t>(p) << 32) | i);
+            }
+        });
+    }
+
+    std::vector<uint64_t> next(kProducers, 0);
+    uint64_t              received = 0;
+    uint64_t              value = 0;
+    while (received < kProducers * kPerProducer) {
+        if (!queue.pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int      p = static_cast<int>(value >> 32);
+        uint64_t seq = value & 0xffffffffu;
+        CHECK(p < kProducers);
+        CHECK(seq == next[p]);
+        ++next[p];
+        ++received;
+    }
+    for (std::thread& t : producers) {
+        t.join();
+    }
+    CHECK(!queue.pop(&value));
+    CHECK(queue.empty());
+}
+
+struct ListNode {
+    ListNode* next;
+    uint64_t  value;
+};
+
+// 链表没有容量上限：每个生产者的元素按入队顺序取出，
+// push返回true（链表从空变成非空）的次数正好等于消费者取到非空批次的次数
+static void testListKeepsOrder() {
+    const int             kProducers = 16;
+    const uint64_t        kPerProducer = 50000;
+    MpscList<ListNode>    list;
+    std::atomic<uint64_t> firsts(0);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&list, &firsts, p, kPerProducer]() {
+            for (uint64_t i = 0; i < kPerProducer; ++i) {
+                ListNode* node = new ListNode;
+                node->value = (static_cast<uint64_t>(p) << 32) | i;
+                if (list.push(node)) {
+                    ++firsts;
+                }
+            }
+        });
+    }
+
+    std::vector<uint64_t> next(kProducers, 0);
+    uint64_t              received = 0;
+    uint64_t              batches = 0;
+    while (received < kProducers * kPerProducer) {
+        ListNode* node = list.popAll();
+        if (!node) {
+            std::this_thread::yield();
+            continue;
+        }
+        ++batches;
+        while (node) {
+            int      p = static_cast<int>(node->value >> 32);
+            uint64_t seq = node->value & 0xffffffffu;
+            CHECK(p < kProducers);
+            CHECK(seq == next[p]);
+            ++next[p];
+            ++received;
+            ListNode* done = node;
+            node = node->next;
+            delete done;
+        }
+    }
+    for (std::thread& t : producers) {
+        t.join();
+    }
+    CHECK(list.empty());
+    CHECK(list.popAll() == nullptr);
+    CHECK(firsts == batches);
+
+    // 没取走的节点随链表释放
+    MpscList<ListNode> pending;
+    CHECK(pending.push(new ListNode));
+    CHECK(!pending.push(new ListNode));
+}
+
+int main() {
+    testNoAllocation();
+    testOverflowKeepsOrder();
+    testListKeepsOrder();
+    return 0;
+}
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "SharedPayload.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "TestUtil.h"
+#include "WriteCounter.h"
+
+// 服务器loop跑在当前线程，client在另一个线程中阻塞收发，返回后退出loop
+// 超过10秒还没结束也退出，测试按结果失败而不是卡住
+static void runWithClient(EventLoop* loop, const std::function<void()>& client) {
+    std::thread thread([loop, &client]() {
+        client();
+        loop->quit();
+    });
+    loop->runAfter(10.0, [loop]() { loop->quit(); });
+    loop->loop();
+    thread.join();
+}
+
+static std::string makePattern(size_t len) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+        data[i] = static_cast<char>('a' + (i * 7) % 26);
+    }
+    return data;
+}
+
+// 边沿触发下文件比sendFile给的长度短：丢弃这个文件段之后要接着发后面排队的数据，
+// 不能因为sendfile返回0就停下来等一个不会再来的EPOLLOUT
+static void testShortFileDoesNotStall() {
+    const uint16_t kPort = 19301;
+    char           path[] = "/tmp/mymuduo_sendfileXXXXXX";
+    int            filefd = ::mkstemp(path);
+    CHECK(filefd >= 0);
+    ::unlink(path);
+    const std::string content = makePattern(4 * 1024 * 1024);
+    writeAll(filefd, content);
+
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "ShortFile");
+    server.setEdgeTriggered(true);
+    server.setConnectionCallback([filefd, &content](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->send(std::string("head"));
+            conn->sendFile(filefd, 0, content.size() + 4096);
+            conn->send(std::string("tail"));
+        }
+    });
+    server.start();
+
+    std::string received;
+    runWithClient(&loop, [&]() {
+        // 接收窗口很小，文件段一定会排队等EPOLLOUT
+        int sock = connectLoopback(kPort, 4096);
+        received = readFor(sock, content.size() + 8);
+        ::close(sock);
+    });
+    ::close(filefd);
+    CHECK(received.size() == content.size() + 8);
+    CHECK(received == "head" + content + "tail");
+}
+
+// 零拷贝发出去、内核还没通知完成的内存，在连接销毁之后也不能释放（还回内存池）
+// 对端不读，发送队列里还有零拷贝的数据时关闭连接，payload要等对端读完之后才释放
+static void testZeroCopyPinsOutliveConnection() {
+    const uint16_t kPort = 19302;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "ZeroCopyLinger");
+    server.setZeroCopy(64 * 1024);
+    const size_t                kSize = 4 * 1024 * 1024;
+    std::weak_ptr<const SharedPayload> weakPayload;
+    std::atomic_bool                   sent(false);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            SharedPayloadPtr payload =
+                SharedPayload::create(makePattern(kSize));
+            weakPayload = payload;
+            conn->send(payload);
+            conn->forceClose();
+            sent = true;
+        }
+    });
+    server.start();
+
+    bool        zeroCopySent = false;
+    bool        aliveAfterClose = false;
+    bool        releasedAfterRead = false;
+    std::string received;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        while (!sent) {
+            ::usleep(1000);
+        }
+        // 连接已经关闭并销毁，发送队列里的数据还没有被读走
+        ::usleep(300 * 1000);
+        zeroCopySent = server.zeroCopyCounters().sends > 0;
+        aliveAfterClose = !weakPayload.expired();
+        // 读走数据之后内核发出剩下的部分并通知完成，连接随之释放，socket关闭
+        received = readFor(sock, kSize + 1);
+        for (int i = 0; i < 200 && !weakPayload.expired(); ++i) {
+            ::usleep(10 * 1000);
+        }
+        releasedAfterRead = weakPayload.expired();
+        ::close(sock);
+    });
+    if (!zeroCopySent) {
+        ::printf("SO_ZEROCOPY unavailable, skip zero copy linger test\n");
+        return;
+    }
+    CHECK(aliveAfterClose);
+    CHECK(releasedAfterRead);
+    CHECK(server.zeroCopyCounters().fallbacks == 0);
+}
+
+// 边沿触发下一次事件读满字节预算就停下，剩下的数据不会再有边沿通知，
+// 必须由continueReadInLoop在下一轮接着读，否则客户端写完之后服务器就停住了
+static void testReadBudgetHandoff() {
+    const uint16_t kPort = 19303;
+    const size_t   kTotal = 1024 * 1024;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "ReadBudget");
+    server.setEdgeTriggered(true, 4096);
+    size_t received = 0;
+    server.setMessageCallback(
+        [&received, kTotal](const TcpConnectionPtr& conn, Buffer* buf,
+                            Timestamp) {
+            received += buf->readableBytes();
+            buf->retrieveAll();
+            if (received == kTotal) {
+                conn->send(std::string("done"));
+            }
+        });
+    server.start();
+
+    std::string reply;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        writeAll(sock, makePattern(kTotal));
+        reply = readFor(sock, 4);
+        ::close(sock);
+    });
+    CHECK(received == kTotal);
+    CHECK(reply == "done");
+    CHECK(loop.budgetStats().readBudgetHits > 0);
+}
+
+// 写也一样：一次EPOLLOUT最多写eventByteBudget字节，写满预算时如果没有遇到EAGAIN，
+// 内核不会再通知EPOLLOUT，要由continueWriteInLoop接着写。
+// 排队的是许多小文件段，每次sendfile都能完整写出一段，不会遇到EAGAIN
+static void testWriteBudgetHandoff() {
+    const uint16_t kPort = 19304;
+    const size_t   kSegment = 16 * 1024;
+    char           path[] = "/tmp/mymuduo_budgetXXXXXX";
+    int            filefd = ::mkstemp(path);
+    CHECK(filefd >= 0);
+    ::unlink(path);
+    const std::string head = makePattern(1024 * 1024);
+    const std::string content = makePattern(4 * 1024 * 1024);
+    writeAll(filefd, content);
+
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "WriteBudget");
+    server.setEdgeTriggered(true, 4096);
+    server.setConnectionCallback(
+        [filefd, &head, &content, kSegment](const TcpConnectionPtr& conn) {
+            if (conn->connected()) {
+                // 对端还没开始读，head写满发送缓冲区，文件段都排队等EPOLLOUT
+                conn->send(head);
+                for (size_t off = 0; off < content.size(); off += kSegment) {
+                    conn->sendFile(filefd, off, kSegment);
+                }
+            }
+        });
+    server.start();
+
+    std::string received;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        ::usleep(200 * 1000);
+        received = readFor(sock, head.size() + content.size());
+        ::close(sock);
+    });
+    ::close(filefd);
+    CHECK(received.size() == head.size() + content.size());
+    CHECK(received == head + content);
+}
+
+// 边沿触发下输入积压到高水位时停止读，同一轮循环里应用消费掉积压、恢复读。
+// 停止和恢复在poll之前合并成没有变化，但内核里剩下的数据不会再有边沿，
+// 恢复读时必须重新提交EPOLLIN，否则客户端写完之后服务器就停住了
+static void testEdgeTriggeredPauseResumeInOneIteration() {
+    const uint16_t kPort = 19305;
+    const size_t   kTotal = 1024 * 1024;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "PauseResume");
+    server.setEdgeTriggered(true);
+    server.setConnectionCallback([](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->setInputWaterMark(4096, 0);
+        }
+    });
+    size_t received = 0;
+    server.setMessageCallback([&loop, &received, kTotal](
+                                  const TcpConnectionPtr& conn, Buffer*,
+                                  Timestamp) {
+        // 本轮的回调里再消费，这时读已经因为高水位暂停了
+        loop.queueInLoop([conn, &received, kTotal]() {
+            Buffer* buf = conn->inputBuffer();
+            received += buf->readableBytes();
+            buf->retrieveAll();
+            conn->checkInputWaterMark();
+            if (received == kTotal) {
+                conn->send(std::string("done"));
+            }
+        });
+    });
+    server.start();
+
+    std::string reply;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        writeAll(sock, makePattern(kTotal));
+        reply = readFor(sock, 4);
+        ::close(sock);
+    });
+    CHECK(received == kTotal);
+    CHECK(reply == "done");
+}
+
+// 比原来的8格暂存数组多得多的生产者同时向一个连接send：loop被占住期间
+// 所有发送都挂在暂存链表上，之后只drain一次、合并成一次发送，
+// 每个生产者的消息保持各自的顺序
+static void testStagedSendBurst() {
+    const uint16_t   kPort = 19306;
+    const int        kProducers = 32;
+    const int        kPerProducer = 16;
+    const int        kTotal = kProducers * kPerProducer;
+    const size_t     kRecord = 6;  // 两位生产者编号加四位序号
+    EventLoop        loop;
+    TcpServer        server(&loop, InetAddress(kPort), "StagedBurst");
+    TcpConnectionPtr serverConn;
+    std::atomic_bool ready(false);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            serverConn = conn;
+            ready = true;
+        }
+    });
+    server.start();
+
+    std::string      received;
+    std::atomic<int> pushed(0);
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        while (!ready) {
+            ::usleep(1000);
+        }
+        // 占住loop，直到所有生产者都send完
+        loop.runInLoop([&pushed, kTotal]() {
+            while (pushed < kTotal) {
+                std::this_thread::yield();
+            }
+        });
+        std::vector<std::thread> producers;
+        for (int p = 0; p < kProducers; ++p) {
+            producers.emplace_back([&, p]() {
+                for (int i = 0; i < kPerProducer; ++i) {
+                    char record[kRecord + 1];
+                    ::snprintf(record, sizeof record, "%02d%04d", p, i);
+                    serverConn->send(std::string(record, kRecord));
+                    ++pushed;
+                }
+            });
+        }
+        for (std::thread& t : producers) {
+            t.join();
+        }
+        received = readFor(sock, kTotal * kRecord);
+        ::close(sock);
+    });
+
+    CHECK(received.size() == kTotal * kRecord);
+    std::vector<int> next(kProducers, 0);
+    for (size_t off = 0; off < received.size(); off += kRecord) {
+        int p = ::atoi(received.substr(off, 2).c_str());
+        int i = ::atoi(received.substr(off + 2, 4).c_str());
+        CHECK(p >= 0 && p < kProducers);
+        CHECK(i == next[p]);
+        ++next[p];
+    }
+    CHECK(serverConn->stagedSendCount() == static_cast<uint64_t>(kTotal));
+    CHECK(serverConn->stagedBatchCount() == 1);
+}
+
+// 合并写：一个回调里的三次send只在本轮末尾writev一次；flush()立即写出；
+// 关闭合并写之后每次send都立即写。客户端发一个字节选择场景，
+// 服务器关掉Nagle，统计loop线程写socket的次数
+static void testWriteCoalescing() {
+    const uint16_t kPort = 19307;
+    EventLoop      loop;
+    TcpServer      server(&loop, InetAddress(kPort), "Coalescing");
+    server.setConnectionCallback([](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            conn->setTcpNoDelay(true);
+        }
+    });
+    size_t coalescedInCallback = 99;
+    size_t coalescedAtEnd = 99;
+    size_t flushed = 99;
+    size_t flushedAtEnd = 99;
+    size_t immediate = 99;
+    server.setMessageCallback([&](const TcpConnectionPtr& conn, Buffer* buf,
+                                  Timestamp) {
+        const std::string command = buf->retrieveAllAsString();
+        if (command == "c") {
+            conn->setWriteCoalescing(true);
+            WriteCounter::start();
+            conn->send(std::string("a"));
+            conn->send(std::string("b"));
+            conn->send(std::string("c"));
+            coalescedInCallback = WriteCounter::stop();
+            // 排在send登记的flush之后执行
+            WriteCounter::start();
+            loop.runAtIterationEnd(
+                [&]() { coalescedAtEnd = WriteCounter::stop(); });
+        } else if (command == "f") {
+            WriteCounter::start();
+            conn->send(std::string("d"));
+            conn->send(std::string("e"));
+            conn->flush();
+            flushed = WriteCounter::stop();
+            WriteCounter::start();
+            loop.runAtIterationEnd(
+                [&]() { flushedAtEnd = WriteCounter::stop(); });
+        } else if (command == "i") {
+            conn->setWriteCoalescing(false);
+            WriteCounter::start();
+            conn->send(std::string("x"));
+            conn->send(std::string("y"));
+            conn->send(std::string("z"));
+            immediate = WriteCounter::stop();
+        }
+    });
+    server.start();
+
+    std::string coalescedReply;
+    std::string flushedReply;
+    std::string immediateReply;
+    runWithClient(&loop, [&]() {
+        int sock = connectLoopback(kPort);
+        writeAll(sock, "c");
+        coalescedReply = readFor(sock, 3);
+        writeAll(sock, "f");
+        flushedReply = readFor(sock, 2);
+        writeAll(sock, "i");
+        immediateReply = readFor(sock, 3);
+        ::close(sock);
+    });
+    CHECK(coalescedReply == "abc");
+    CHECK(coalescedInCallback == 0);
+    CHECK(coalescedAtEnd == 1);
+    CHECK(flushedReply == "de");
+    CHECK(flushed == 1);
+    CHECK(flushedAtEnd == 0);
+    CHECK(immediateReply == "xyz");
+    CHECK(immediate == 3);
+}
+
+int main() {
+    testShortFileDoesNotStall();
+    testZeroCopyPinsOutliveConnection();
+    testReadBudgetHandoff();
+    testWriteBudgetHandoff();
+    testEdgeTriggeredPauseResumeInOneIteration();
+    testStagedSendBurst();
+    testWriteCoalescing();
+    return 0;
+}
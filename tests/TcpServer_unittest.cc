@@ -0,0 +1,223 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "TestUtil.h"
+
+// 连接分布在几个subloop上反复建立和关闭，检查每个loop的连接表：
+// 槽位复用、id不冲突、forEachConnection正好看到还活着的连接，以及带着连接析构
+static const int kLoops = 3;
+static const int kClients = 12;
+static const int kRounds = 20;
+
+// 连接id的布局，和TcpServer中的一致
+static uint32_t shardOf(uint64_t id) {
+    return static_cast<uint32_t>(id) >> 24;
+}
+
+static uint32_t slotOf(uint64_t id) {
+    return static_cast<uint32_t>(id) & ((1u << 24) - 1);
+}
+
+// 等到cond成立，最多等timeoutMs毫秒
+static bool waitFor(const std::function<bool()>& cond, int timeoutMs = 3000) {
+    for (int i = 0; i < timeoutMs; ++i) {
+        if (cond()) {
+            return true;
+        }
+        ::usleep(1000);
+    }
+    return cond();
+}
+
+// 服务器建立连接后把自己的id发给客户端，客户端据此知道每个socket对应的连接
+static void sendId(const TcpConnectionPtr& conn) {
+    uint64_t id = conn->id();
+    conn->send(&id, sizeof id);
+}
+
+static uint64_t readId(int sock) {
+    std::string data = readFor(sock, sizeof(uint64_t));
+    CHECK(data.size() == sizeof(uint64_t));
+    uint64_t id;
+    ::memcpy(&id, data.data(), sizeof id);
+    return id;
+}
+
+static std::set<uint64_t> liveIds(const TcpServer& server) {
+    std::set<uint64_t> ids;
+    server.forEachConnection([&ids](const TcpConnectionPtr& conn) {
+        CHECK(ids.insert(conn->id()).second);
+    });
+    return ids;
+}
+
+struct Client {
+    int      sock;
+    uint64_t id;
+};
+
+// 每一轮补满kClients个连接，再关掉其中一部分，每一步都核对服务器的连接表
+static void testChurn(uint16_t port, TcpServer::Option option) {
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(port), "Churn", option);
+    server.setThreadNum(kLoops);
+    std::mutex         mutex;
+    std::set<uint64_t> seen;  // 出现过的所有id
+    int                collisions = 0;
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!seen.insert(conn->id()).second) {
+                    ++collisions;
+                }
+            }
+            sendId(conn);
+        }
+    });
+    server.start();
+
+    std::vector<Client>   clients;
+    std::vector<uint64_t> closedIds;
+    bool                  liveMatched = true;
+    bool                  lookupMatched = true;
+    // 等服务器处理完所有建立和关闭，再核对连接表和客户端手里的连接
+    auto verify = [&]() {
+        std::set<uint64_t> expected;
+        for (const Client& c : clients) {
+            expected.insert(c.id);
+        }
+        waitFor([&]() { return server.numConnections() == expected.size(); });
+        if (liveIds(server) != expected) {
+            liveMatched = false;
+        }
+        for (const Client& c : clients) {
+            TcpConnectionPtr conn = server.connection(c.id);
+            if (!conn || conn->id() != c.id) {
+                lookupMatched = false;
+            }
+        }
+        // 槽位已经被新连接复用，旧id也查不到新连接
+        for (uint64_t id : closedIds) {
+            if (server.connection(id)) {
+                lookupMatched = false;
+            }
+        }
+    };
+    std::thread thread([&]() {
+        for (int round = 0; round < kRounds; ++round) {
+            while (clients.size() < static_cast<size_t>(kClients)) {
+                int sock = connectLoopback(port);
+                clients.push_back(Client{sock, readId(sock)});
+                verify();
+            }
+            // 每一轮关掉的位置不同，空出来的槽位分散在各个loop上
+            for (int i = kClients - 1 - round % 2; i >= 0; i -= 2) {
+                ::close(clients[i].sock);
+                closedIds.push_back(clients[i].id);
+                clients.erase(clients.begin() + i);
+                verify();
+            }
+        }
+        for (const Client& c : clients) {
+            ::close(c.sock);
+        }
+        waitFor([&]() { return server.numConnections() == 0; });
+        loop.quit();
+    });
+    loop.runAfter(30.0, [&loop]() { loop.quit(); });
+    loop.loop();
+    thread.join();
+
+    CHECK(liveMatched);
+    CHECK(lookupMatched);
+    CHECK(server.numConnections() == 0);
+    CHECK(liveIds(server).empty());
+    std::lock_guard<std::mutex> lock(mutex);
+    CHECK(collisions == 0);
+    // 同时在线的连接不超过kClients，每个loop的槽位一直在复用
+    const size_t total = seen.size();
+    CHECK(total == closedIds.size() + clients.size());
+    CHECK(total ==
+          static_cast<size_t>(kClients + (kRounds - 1) * kClients / 2));
+    std::set<uint32_t> shards;
+    for (uint64_t id : seen) {
+        shards.insert(shardOf(id));
+        CHECK(slotOf(id) < static_cast<uint32_t>(kClients));
+    }
+    CHECK(shards.size() == static_cast<size_t>(kLoops));
+}
+
+// 还有连接在线时析构TcpServer，同时客户端在关闭一部分连接：
+// 析构要在各个loop中销毁剩下的连接，每个连接正好回调一次断开
+static void testDestroyWithOpenConnections(uint16_t port) {
+    EventLoop         loop;
+    std::atomic<int>  up(0);
+    std::atomic<int>  down(0);
+    std::vector<int>  socks;
+    std::atomic_bool  serverGone(false);
+    bool              allEof = true;
+    std::thread       thread;
+    {
+        TcpServer server(&loop, InetAddress(port), "Destroy");
+        server.setThreadNum(kLoops);
+        server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+            if (conn->connected()) {
+                ++up;
+                sendId(conn);
+            } else {
+                ++down;
+            }
+        });
+        server.start();
+        thread = std::thread([&]() {
+            for (int i = 0; i < kClients; ++i) {
+                int sock = connectLoopback(port);
+                readId(sock);
+                socks.push_back(sock);
+            }
+            waitFor([&]() {
+                return server.numConnections() ==
+                       static_cast<size_t>(kClients);
+            });
+            loop.quit();
+            // 和析构同时进行，关闭事件可能在析构之前或者之后到达subloop
+            for (int i = 0; i < kClients; i += 2) {
+                ::close(socks[i]);
+            }
+            waitFor([&]() { return serverGone.load(); });
+            for (int i = 1; i < kClients; i += 2) {
+                if (!readFor(socks[i], 1).empty()) {
+                    allEof = false;
+                }
+                ::close(socks[i]);
+            }
+        });
+        loop.runAfter(10.0, [&loop]() { loop.quit(); });
+        loop.loop();
+    }
+    serverGone = true;
+    thread.join();
+    CHECK(up == kClients);
+    CHECK(down == kClients);
+    CHECK(allEof);
+}
+
+int main() {
+    testChurn(19331, TcpServer::kNoReusePort);
+    testChurn(19332, TcpServer::kReusePortPerLoop);
+    testDestroyWithOpenConnections(19333);
+    return 0;
+}
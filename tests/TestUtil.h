@@ -0,0 +1,77 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+// 测试用的断言，不受NDEBUG影响，失败时打印位置并以非0退出
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            ::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,  \
+                      __LINE__, #cond);                               \
+            ::exit(1);                                                \
+        }                                                             \
+    } while (0)
+
+// 阻塞地连接本机port，rcvbuf大于0时先设置接收缓冲区（连接前设置才能影响窗口）
+inline int connectLoopback(uint16_t port, int rcvbuf = 0) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    if (rcvbuf > 0) {
+        CHECK(::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                           sizeof rcvbuf) == 0);
+    }
+    sockaddr_in addr;
+    ::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // 服务器在另一个线程中开始监听，稍微重试几次
+    for (int i = 0; i < 100; ++i) {
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) ==
+            0) {
+            return fd;
+        }
+        ::usleep(10 * 1000);
+    }
+    CHECK(false && "connect");
+    return -1;
+}
+
+// 读到len字节、对端关闭或者超过timeoutMs没有新数据为止
+inline std::string readFor(int fd, size_t len, int timeoutMs = 3000) {
+    std::string result;
+    char        buf[64 * 1024];
+    while (result.size() < len) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (::poll(&pfd, 1, timeoutMs) <= 0) {
+            break;
+        }
+        size_t  want = std::min(sizeof buf, len - result.size());
+        ssize_t n = ::read(fd, buf, want);
+        if (n <= 0) {
+            break;
+        }
+        result.append(buf, n);
+    }
+    return result;
+}
+
+inline void writeAll(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+        CHECK(n > 0);
+        off += n;
+    }
+}
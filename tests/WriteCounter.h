@@ -0,0 +1,53 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// 替换write/writev/sendmsg，统计当前线程在一段代码中写socket的次数
+// 替换函数每个程序只能定义一次，只在测试的main文件中包含这个头文件
+// 只统计调用了WriteCounter::start()的线程，eventfd等非socket的写不计入
+
+namespace WriteCounter {
+
+__thread bool   t_counting = false;
+__thread size_t t_writes = 0;
+
+// 开始统计当前线程写socket的次数
+inline void start() {
+    t_writes = 0;
+    t_counting = true;
+}
+
+// 停止统计，返回start()之后写socket的次数
+inline size_t stop() {
+    t_counting = false;
+    return t_writes;
+}
+
+inline void count(int fd) {
+    struct stat st;
+    if (t_counting && ::fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        ++t_writes;
+    }
+}
+
+}  // namespace WriteCounter
+
+// 计数之后直接发起系统调用
+extern "C" ssize_t write(int fd, const void* buf, size_t count) {
+    WriteCounter::count(fd);
+    return ::syscall(SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    WriteCounter::count(fd);
+    return ::syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
+    WriteCounter::count(fd);
+    return ::syscall(SYS_sendmsg, fd, msg, flags);
+}